@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dlfcn.h>
+
+#include "aot.h"
+#include "chip8.h"
+#include "profile.h"
+#include "trace.h"
+
+struct aot_t *aot_load(const char *const file_name) {
+  struct aot_t *const aot=calloc(1, sizeof(struct aot_t));
+  if(!aot) return NULL;
+  // dlopen() only searches the library path for names without a slash.
+  char path[4096];
+  snprintf(path, sizeof(path), "%s%s", strchr(file_name, '/') ? "" : "./", file_name);
+  aot->handle=dlopen(path, RTLD_NOW|RTLD_LOCAL);
+  if(aot->handle) aot->image=dlsym(aot->handle, AOT_SYMBOL);
+  if(!aot->image || aot->image->abi != AOT_ABI || aot->image->state_size != sizeof(struct chip8_t)) {
+    aot_unload(aot);
+    return NULL;
+  }
+  return aot;
+}
+
+void aot_unload(struct aot_t *const aot) {
+  if(!aot) return;
+  if(aot->handle) dlclose(aot->handle);
+  free(aot);
+}
+
+static void invalidate(void *context, uint16_t addr, uint16_t size) {
+  struct aot_t *const aot=context;
+  // A block covers at most AOT_MAX_BLOCK instructions, so only blocks with
+  // instructions in that window before the write can overlap it.
+  const int first=(int)addr-AOT_MAX_BLOCK*INSTRUCTION_SIZE;
+  for(int at=first < 0 ? 0 : first; at < addr+size && at <= RAM_MASK; ++at) {
+    const struct aot_block_t *const block=aot->blocks[at];
+    if(block && block->start+block->length*INSTRUCTION_SIZE > addr) aot->blocks[at]=NULL;
+  }
+}
+
+int aot_attach(struct aot_t *const aot, struct chip8_t *const chip8) {
+  const struct aot_image_t *const image=aot->image;
+  if(image->quirks != chip8->quirks) return -1;
+  memset(aot->blocks, 0, sizeof(aot->blocks));
+  int enabled=0;
+  for(uint32_t b=0; b<image->block_count; ++b) {
+    const struct aot_block_t *const block=image->blocks+b;
+    int same=1;
+    for(uint16_t at=0; at<block->length*INSTRUCTION_SIZE; ++at)
+      same&=chip8->ram[(block->start+at) & RAM_MASK] == image->ram[(block->start+at) & RAM_MASK];
+    if(!same) continue;
+    for(uint16_t k=0; k<block->length; ++k) aot->blocks[(block->start+k*INSTRUCTION_SIZE) & RAM_MASK]=block;
+    enabled++;
+  }
+  chip8->on_write=invalidate;
+  chip8->on_write_context=aot;
+  return enabled;
+}
+
+// Instructions left in the block from pc on, 0 if pc is not in one.
+static uint16_t remaining(const struct aot_t *const aot, const struct chip8_t *const chip8) {
+  // Compiled blocks would bypass the tracing and profiling hooks in cycle().
+  const struct aot_block_t *const block=CHIP8_PROFILE || CHIP8_TRACE ? NULL : aot->blocks[chip8->pc & RAM_MASK];
+  // pc past the end of ram only shares the slot of an address in a block.
+  if(!block || chip8->pc < block->start || chip8->pc >= block->start+block->length*INSTRUCTION_SIZE) return 0;
+  return block->length-(chip8->pc-block->start)/INSTRUCTION_SIZE;
+}
+
+void aot_run(struct aot_t *const aot, struct chip8_t *const chip8, uint64_t cycles) {
+  while(cycles) {
+    const uint16_t left=remaining(aot, chip8);
+    if(!left || left > cycles) {
+      cycle(chip8);
+      aot->interpreted++;
+      cycles--;
+      continue;
+    }
+    const struct aot_block_t *const block=aot->blocks[chip8->pc & RAM_MASK];
+    block->code(chip8, block->length-left);
+    aot->compiled+=left;
+    cycles-=left;
+  }
+}
+
+uint64_t aot_lockstep(struct aot_t *const aot, struct chip8_t *const chip8, struct chip8_t *const reference, uint64_t cycles) {
+  uint64_t done=0;
+  while(done < cycles) {
+    const uint16_t pc=chip8->pc;
+    const uint16_t left=remaining(aot, chip8);
+    const uint64_t step=left && left <= cycles-done ? left : 1;
+    aot_run(aot, chip8, step);
+    for(uint64_t c=0; c<step; ++c) cycle(reference);
+    if(!same_state(chip8, reference)) {
+      fprintf(stderr, "[ERROR] aot image diverged after %lu cycles, block at 0x%04X\n", done, pc);
+      break;
+    }
+    done+=step;
+  }
+  return done;
+}
@@ -0,0 +1,64 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+// Ahead-of-time images built by chip8-aot: the code reachable from ORG in
+// one ROM, as one C function per basic block calling the handlers in
+// ops.h, compiled into a shared object. Loading one replaces cycle() for
+// every pc that starts a compiled block; anything else (Bnnn targets, code
+// the walk could not see, blocks overwritten since) runs interpreted.
+
+// Bumped whenever struct chip8_t, ops.h or the structs below change, so a
+// stale image is refused instead of run.
+#define AOT_ABI 2
+#define AOT_SYMBOL "chip8_aot_image"
+#define AOT_MAX_BLOCK 64
+
+// Runs the block's instructions from number `entry` to its end, as cycle()
+// would; a frame can end and the next one resume anywhere inside a block.
+typedef void (*aot_entry)(struct chip8_t *chip8, unsigned entry);
+
+struct aot_block_t {
+  aot_entry code;
+  uint16_t start, length;
+};
+
+// What an image exports under AOT_SYMBOL.
+struct aot_image_t {
+  uint32_t abi;
+  uint32_t state_size; // sizeof(struct chip8_t) where it was compiled
+  uint8_t quirks; // enum quirks_t the handlers were instantiated for
+  uint32_t block_count;
+  const struct aot_block_t *blocks;
+  const uint8_t *ram; // as booted, what the blocks were compiled from
+};
+
+struct aot_t {
+  void *handle;
+  const struct aot_image_t *image;
+  // By the address of each instruction in a block; NULL where cycle()
+  // runs instead.
+  const struct aot_block_t *blocks[1<<12];
+  uint64_t compiled, interpreted; // cycles run each way
+};
+
+// Returns NULL if the file cannot be loaded or was built for another ABI.
+struct aot_t *aot_load(const char *const file_name);
+void aot_unload(struct aot_t *const aot);
+// Enables the blocks whose bytes match chip8's ram and hooks
+// chip8->on_write so stores drop the blocks they hit. Returns how many
+// are enabled, or -1 if the image was built for other quirks.
+int aot_attach(struct aot_t *const aot, struct chip8_t *const chip8);
+// Runs exactly `cycles` instructions, falling back to cycle() when the
+// next block would overshoot.
+void aot_run(struct aot_t *const aot, struct chip8_t *const chip8, uint64_t cycles);
+// Runs the same instructions through aot_run() on `chip8` and cycle() on
+// `reference`, a copy without on_write, comparing the state after every
+// block. Returns the number of cycles executed before the first mismatch,
+// or `cycles` if none.
+uint64_t aot_lockstep(struct aot_t *const aot, struct chip8_t *const chip8, struct chip8_t *const reference, uint64_t cycles);
+
+#endif
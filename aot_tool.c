@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "aot.h"
+#include "chip8.h"
+#include "input.h"
+#include "ops.h"
+
+// Compiles a ROM ahead of time: walks the code reachable from ORG, writes
+// it out as C with one function per basic block and builds that into a
+// shared object for chip8-headless --aot. --verify instead runs an image
+// against the interpreter, comparing the state after every block.
+
+#ifndef AOT_INCLUDE_DIR
+#define AOT_INCLUDE_DIR "."
+#endif
+
+#define DEFAULT_VERIFY_CYCLES 10000000
+
+struct quirk_flags_t {
+  int shift_vx, keep_i, jump_vx, wrap;
+};
+
+#define X(name, shift_vx, keep_i, jump_vx, wrap) { shift_vx, keep_i, jump_vx, wrap },
+static const struct quirk_flags_t quirk_flags[QUIRKS_COUNT]={ QUIRK_PROFILES };
+#undef X
+
+// What a walk of the ROM found, per ram address.
+struct code_map_t {
+  uint8_t reachable[RAM_MASK+1];
+  uint8_t leader[RAM_MASK+1]; // starts a block: ORG, a branch target or past a full block
+  uint8_t length[RAM_MASK+1]; // instructions in the block at each leader
+};
+
+// Instructions after which pc is not simply the next address, or that may
+// store into code still to come in the block.
+static int ends_block(enum kind_t kind) {
+  switch(kind) {
+  case KIND_0nnn: case KIND_00ee: case KIND_1nnn: case KIND_2nnn: case KIND_3xkk:
+  case KIND_4xkk: case KIND_5xy0: case KIND_9xy0: case KIND_bnnn: case KIND_ex9e:
+  case KIND_exa1: case KIND_fx0a: case KIND_00fd: case KIND_fx33: case KIND_fx55:
+  case KIND_unknown:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static void mark(struct code_map_t *const map, uint16_t stack[], int *const count, uint32_t addr, int leader) {
+  // Code running off the end of ram would be at a pc no block can match.
+  if(addr > RAM_MASK) return;
+  if(leader) map->leader[addr]=1;
+  if(map->reachable[addr]) return;
+  map->reachable[addr]=1;
+  stack[(*count)++]=addr;
+}
+
+// Bnnn targets depend on a register, so the walk stops there and whatever
+// it leads to runs interpreted.
+static void walk(const struct chip8_t *const chip8, struct code_map_t *const map) {
+  static uint16_t stack[RAM_MASK+1];
+  int count=0;
+  memset(map, 0, sizeof(*map));
+  mark(map, stack, &count, ORG, 1);
+  while(count) {
+    const uint16_t at=stack[--count];
+    const uint16_t opcode=fetch(chip8, at);
+    const uint32_t next=at+INSTRUCTION_SIZE;
+    switch(kind_of(opcode)) {
+    case KIND_0nnn: case KIND_1nnn:
+      mark(map, stack, &count, opcode & 0xFFF, 1);
+      break;
+    case KIND_2nnn:
+      mark(map, stack, &count, opcode & 0xFFF, 1);
+      mark(map, stack, &count, next, 1);
+      break;
+    case KIND_3xkk: case KIND_4xkk: case KIND_5xy0: case KIND_9xy0: case KIND_ex9e: case KIND_exa1:
+      mark(map, stack, &count, next, 1);
+      mark(map, stack, &count, next+INSTRUCTION_SIZE, 1);
+      break;
+    case KIND_00ee: case KIND_bnnn: case KIND_00fd:
+      break;
+    case KIND_unknown:
+      if((opcode >> 12) == 0xf) mark(map, stack, &count, next, 1);
+      break;
+    default:
+      mark(map, stack, &count, next, ends_block(kind_of(opcode)));
+      break;
+    }
+  }
+}
+
+static void emit_op(FILE *const out, uint16_t opcode, const struct quirk_flags_t *const flags) {
+  const uint8_t x=(opcode >> 8) & 0xF, y=(opcode >> 4) & 0xF, n=opcode & 0xF, kk=opcode & 0xFF;
+  const uint16_t nnn=opcode & 0xFFF;
+  switch(kind_of(opcode)) {
+  case KIND_0nnn: fprintf(out, "op_0nnn(chip8, 0x%03X);", nnn); break;
+  case KIND_00e0: fprintf(out, "op_00e0(chip8);"); break;
+  case KIND_00ee: fprintf(out, "op_00ee(chip8);"); break;
+  case KIND_00cn: fprintf(out, "op_00cn(chip8, %d);", n); break;
+  case KIND_00fb: fprintf(out, "op_00fb(chip8);"); break;
+  case KIND_00fc: fprintf(out, "op_00fc(chip8);"); break;
+  case KIND_00fd: fprintf(out, "op_00fd(chip8);"); break;
+  case KIND_00fe: fprintf(out, "op_00fe(chip8);"); break;
+  case KIND_00ff: fprintf(out, "op_00ff(chip8);"); break;
+  case KIND_1nnn: fprintf(out, "op_1nnn(chip8, 0x%03X);", nnn); break;
+  case KIND_2nnn: fprintf(out, "op_2nnn(chip8, 0x%03X);", nnn); break;
+  case KIND_3xkk: fprintf(out, "op_3xkk(chip8, %d, 0x%02X);", x, kk); break;
+  case KIND_4xkk: fprintf(out, "op_4xkk(chip8, %d, 0x%02X);", x, kk); break;
+  case KIND_5xy0: fprintf(out, "op_5xy0(chip8, %d, %d);", x, y); break;
+  case KIND_6xkk: fprintf(out, "op_6xkk(chip8, %d, 0x%02X);", x, kk); break;
+  case KIND_7xkk: fprintf(out, "op_7xkk(chip8, %d, 0x%02X);", x, kk); break;
+  case KIND_8xy0: fprintf(out, "op_8xy0(chip8, %d, %d);", x, y); break;
+  case KIND_8xy1: fprintf(out, "op_8xy1(chip8, %d, %d);", x, y); break;
+  case KIND_8xy2: fprintf(out, "op_8xy2(chip8, %d, %d);", x, y); break;
+  case KIND_8xy3: fprintf(out, "op_8xy3(chip8, %d, %d);", x, y); break;
+  case KIND_8xy4: fprintf(out, "op_8xy4(chip8, %d, %d);", x, y); break;
+  case KIND_8xy5: fprintf(out, "op_8xy5(chip8, %d, %d);", x, y); break;
+  case KIND_8xy6: fprintf(out, "op_8xy6(chip8, %d, %d, %d);", x, y, flags->shift_vx); break;
+  case KIND_8xy7: fprintf(out, "op_8xy7(chip8, %d, %d);", x, y); break;
+  case KIND_8xye: fprintf(out, "op_8xye(chip8, %d, %d, %d);", x, y, flags->shift_vx); break;
+  case KIND_9xy0: fprintf(out, "op_9xy0(chip8, %d, %d);", x, y); break;
+  case KIND_annn: fprintf(out, "op_annn(chip8, 0x%03X);", nnn); break;
+  case KIND_bnnn: fprintf(out, "op_bnnn(chip8, 0x%03X, %d);", nnn, flags->jump_vx); break;
+  case KIND_cxkk: fprintf(out, "op_cxkk(chip8, %d, 0x%02X);", x, kk); break;
+  case KIND_dxyn: fprintf(out, "op_dxyn(chip8, %d, %d, %d, %d);", x, y, n, flags->wrap); break;
+  case KIND_ex9e: fprintf(out, "op_ex9e(chip8, %d);", x); break;
+  case KIND_exa1: fprintf(out, "op_exa1(chip8, %d);", x); break;
+  case KIND_fx07: fprintf(out, "op_fx07(chip8, %d);", x); break;
+  case KIND_fx0a: fprintf(out, "op_fx0a(chip8, %d);", x); break;
+  case KIND_fx15: fprintf(out, "op_fx15(chip8, %d);", x); break;
+  case KIND_fx18: fprintf(out, "op_fx18(chip8, %d);", x); break;
+  case KIND_fx1e: fprintf(out, "op_fx1e(chip8, %d);", x); break;
+  case KIND_fx29: fprintf(out, "op_fx29(chip8, %d);", x); break;
+  case KIND_fx30: fprintf(out, "op_fx30(chip8, %d);", x); break;
+  case KIND_fx33: fprintf(out, "op_fx33(chip8, %d);", x); break;
+  case KIND_fx55: fprintf(out, "op_fx55(chip8, %d, %d);", x, flags->keep_i); break;
+  case KIND_fx65: fprintf(out, "op_fx65(chip8, %d, %d);", x, flags->keep_i); break;
+  default: fprintf(out, "op_unknown(chip8, 0x%04X);", opcode); break;
+  }
+}
+
+// Cuts the reachable code into blocks at the leaders, and wherever one
+// grows to AOT_MAX_BLOCK instructions. Returns the number of blocks.
+static uint32_t split(const struct chip8_t *const chip8, struct code_map_t *const map) {
+  uint32_t blocks=0;
+  for(uint32_t start=0; start<=RAM_MASK; ++start) {
+    if(!map->leader[start]) continue;
+    uint32_t at=start;
+    for(map->length[start]=1;; map->length[start]++) {
+      if(ends_block(kind_of(fetch(chip8, at)))) break;
+      at+=INSTRUCTION_SIZE;
+      if(at > RAM_MASK || map->leader[at]) break;
+      if(map->length[start] == AOT_MAX_BLOCK) {
+        map->leader[at]=1;
+        break;
+      }
+    }
+    blocks++;
+  }
+  return blocks;
+}
+
+// Writes the image source. Each block is a switch falling through from the
+// entry instruction to the last one.
+static void emit(FILE *const out, const struct chip8_t *const chip8, const struct code_map_t *const map, const char *const rom_name) {
+  const struct quirk_flags_t *const flags=quirk_flags+chip8->quirks;
+  fprintf(out, "// Generated by chip8-aot from %s (quirks %s). Do not edit.\n\n", rom_name, quirks_name(chip8->quirks));
+  fprintf(out, "#include \"ops.h\"\n#include \"aot.h\"\n");
+  for(uint32_t start=0; start<=RAM_MASK; ++start) {
+    if(!map->leader[start]) continue;
+    fprintf(out, "\nstatic void block_%03X(struct chip8_t *const chip8, unsigned entry) {\n  switch(entry) {\n", start);
+    for(int k=0; k<map->length[start]; ++k) {
+      const uint16_t opcode=fetch(chip8, start+k*INSTRUCTION_SIZE);
+      fprintf(out, "  case %d: ", k);
+      emit_op(out, opcode, flags);
+      fprintf(out, " // %03X %04X\n", start+k*INSTRUCTION_SIZE, opcode);
+    }
+    fprintf(out, "  }\n}\n");
+  }
+  fprintf(out, "\nstatic const struct aot_block_t blocks[]={\n");
+  for(uint32_t start=0; start<=RAM_MASK; ++start)
+    if(map->leader[start]) fprintf(out, "  { block_%03X, 0x%03X, %d },\n", start, start, map->length[start]);
+  fprintf(out, "};\n\nstatic const uint8_t ram[%d]={", RAM_MASK+1);
+  for(uint32_t at=0; at<=RAM_MASK; ++at) fprintf(out, "%s0x%02X,", at % 16 ? " " : "\n  ", chip8->ram[at]);
+  fprintf(out, "\n};\n\nconst struct aot_image_t %s={\n", AOT_SYMBOL);
+  fprintf(out, "  .abi=AOT_ABI,\n  .state_size=sizeof(struct chip8_t),\n  .quirks=QUIRKS_%s,\n", quirks_name(chip8->quirks));
+  fprintf(out, "  .block_count=sizeof(blocks)/sizeof(blocks[0]),\n  .blocks=blocks,\n  .ram=ram,\n};\n");
+}
+
+// Runs `cc` on the source without a shell, so paths need no quoting.
+static int compile(const char *const cc, const char *const include, const char *const source, const char *const image) {
+  char include_flag[4096];
+  snprintf(include_flag, sizeof(include_flag), "-I%s", include);
+  const pid_t pid=fork();
+  if(pid == -1) return -1;
+  if(!pid) {
+    execlp(cc, cc, "-O2", "-shared", "-fPIC", include_flag, "-DCHIP8_TRACE=0", "-DCHIP8_PROFILE=0", "-o", image, source, (char *)NULL);
+    _exit(127);
+  }
+  int status;
+  if(waitpid(pid, &status, 0) == -1) return -1;
+  return WIFEXITED(status) && !WEXITSTATUS(status) ? 0 : -1;
+}
+
+// Same slicing as run(), with the reference seeing the same keypad.
+static int verify(struct aot_t *const aot, struct chip8_t *const chip8, struct chip8_t *const reference, uint64_t ipf, struct input_script_t *const input, uint64_t cycles) {
+  uint64_t done=0, frame=0;
+  while(done < cycles) {
+    const uint64_t next_event=input ? apply_input(input, chip8, done) : UINT64_MAX;
+    reference->keys=chip8->keys;
+    uint64_t step=cycles-done;
+    if(ipf && step > ipf-frame) step=ipf-frame;
+    if(step > next_event-done) step=next_event-done;
+    if(aot_lockstep(aot, chip8, reference, step) != step) return -1;
+    done+=step;
+    frame+=step;
+    if(ipf && frame == ipf) {
+      tick_timers(chip8);
+      tick_timers(reference);
+      frame=0;
+    }
+  }
+  return 0;
+}
+
+void help() {
+  printf("Help: ./chip8-aot [--quirks=modern|vip|schip|xochip] [--source=FILE] [--cc=COMMAND] [--include=DIR] <rom_file> <image_file>\n");
+  printf("      ./chip8-aot --verify[=CYCLES] [--quirks=NAME] [--ipf=N] [--seed=N] [--input=FILE] <rom_file> <image_file>\n");
+  printf("  --source=FILE   where the generated C goes (default <image_file>.c)\n");
+  printf("  --cc=COMMAND    compiler to build the image with (default cc)\n");
+  printf("  --include=DIR   where chip8.h, ops.h and aot.h are (default %s)\n", AOT_INCLUDE_DIR);
+  printf("  --verify        run the image against the interpreter for CYCLES instructions (default %d)\n", DEFAULT_VERIFY_CYCLES);
+}
+
+int main(int argc, char **argv) {
+  static struct chip8_t chip8, reference;
+  static struct code_map_t map;
+  struct input_script_t input;
+  struct input_script_t *script=NULL;
+  enum quirks_t quirks=QUIRKS_modern;
+  const char *source=NULL, *cc="cc", *include=AOT_INCLUDE_DIR;
+  uint64_t verify_cycles=0, ipf=DEFAULT_IPF, seed=DEFAULT_SEED;
+  int arg=1;
+  for(; arg<argc && !strncmp(argv[arg], "--", 2); ++arg) {
+    int unknown=0;
+    if(!strncmp(argv[arg], "--quirks=", 9)) unknown=parse_quirks(argv[arg]+9, &quirks);
+    else if(!strncmp(argv[arg], "--source=", 9)) source=argv[arg]+9;
+    else if(!strncmp(argv[arg], "--cc=", 5)) cc=argv[arg]+5;
+    else if(!strncmp(argv[arg], "--include=", 10)) include=argv[arg]+10;
+    else if(!strcmp(argv[arg], "--verify")) verify_cycles=DEFAULT_VERIFY_CYCLES;
+    else if(!strncmp(argv[arg], "--verify=", 9)) verify_cycles=strtoull(argv[arg]+9, NULL, 10);
+    else if(!strncmp(argv[arg], "--ipf=", 6)) ipf=strtoull(argv[arg]+6, NULL, 10);
+    else if(!strncmp(argv[arg], "--seed=", 7)) seed=strtoull(argv[arg]+7, NULL, 0);
+    else if(!strncmp(argv[arg], "--input=", 8)) {
+      if(load_input_script(argv[arg]+8, &input)) {
+        fprintf(stderr, "[ERROR] could not read input script %s\n", argv[arg]+8);
+        exit(80);
+      }
+      script=&input;
+    }
+    else unknown=1;
+    if(unknown) {
+      fprintf(stderr, "[ERROR] unknown option %s\n", argv[arg]);
+      help();
+      exit(68);
+    }
+  }
+  if(argc-arg != 2) {
+    fprintf(stderr, "[ERROR] need a rom file and an image file\n");
+    help();
+    exit(68);
+  }
+  const char *const rom=argv[arg], *const image=argv[arg+1];
+  struct chip8_arena_t arena;
+  if(arena_init(&arena, 2)) {
+    fprintf(stderr, "[ERROR] out of memory\n");
+    exit(81);
+  }
+  arena_attach(&arena, &chip8);
+  arena_attach(&arena, &reference);
+  if(boot(&chip8, rom) < 0) {
+    fprintf(stderr, "[ERROR] could not read rom %s\n", rom);
+    exit(80);
+  }
+  set_quirks(&chip8, quirks);
+
+  if(verify_cycles) {
+    struct aot_t *const aot=aot_load(image);
+    if(!aot) {
+      fprintf(stderr, "[ERROR] could not load aot image %s\n", image);
+      exit(80);
+    }
+    seed_random(&chip8, seed);
+    const int enabled=aot_attach(aot, &chip8);
+    if(enabled < 0) {
+      fprintf(stderr, "[ERROR] %s was not built for the %s quirks\n", image, quirks_name(quirks));
+      exit(68);
+    }
+    copy_state(&reference, &chip8);
+    reference.on_write=NULL;
+    const int status=verify(aot, &chip8, &reference, ipf, script, verify_cycles);
+    const uint64_t executed=aot->compiled+aot->interpreted;
+    fprintf(stderr, "%s: %lu cycles, %.1f%% in %d of %u compiled blocks\n", status ? "diverged" : "verified",
+            executed, executed ? 100.0*aot->compiled/executed : 0, enabled, aot->image->block_count);
+    if(script) free_input_script(script);
+    aot_unload(aot);
+    arena_free(&arena);
+    return status ? 90 : EXIT_SUCCESS;
+  }
+
+  char source_name[4096];
+  if(!source) {
+    snprintf(source_name, sizeof(source_name), "%s.c", image);
+    source=source_name;
+  }
+  FILE *const out=fopen(source, "w");
+  if(!out) {
+    fprintf(stderr, "[ERROR] could not write %s\n", source);
+    exit(80);
+  }
+  walk(&chip8, &map);
+  const uint32_t blocks=split(&chip8, &map);
+  emit(out, &chip8, &map, rom);
+  if(fclose(out)) {
+    fprintf(stderr, "[ERROR] could not write %s\n", source);
+    exit(80);
+  }
+  if(compile(cc, include, source, image)) {
+    fprintf(stderr, "[ERROR] %s could not compile %s\n", cc, source);
+    exit(80);
+  }
+  uint32_t reachable=0;
+  for(uint32_t at=0; at<=RAM_MASK; ++at) reachable+=map.reachable[at];
+  fprintf(stderr, "%u reachable instructions in %u blocks, written to %s\n", reachable, blocks, image);
+  arena_free(&arena);
+  return EXIT_SUCCESS;
+}
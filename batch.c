@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "catalog.h"
+#include "chip8.h"
+#include "dynarec.h"
+#include "input.h"
+#include "runner.h"
+#include "simd.h"
+
+// Runs a list of independent jobs across all cores. Every worker owns a
+// contiguous slice of the job list as a deque: it takes work from the back
+// of its own slice and, once that is empty, steals from the front of the
+// others. Jobs are whole emulator runs, so a mutex per deque costs nothing
+// next to the work it hands out.
+//
+// With --simd, consecutive jobs on the same ROM are grouped LANES at a time
+// and each group runs as one vectorised lockstep run (see simd.h).
+//
+// Job list, one job per line ('#' starts a comment):
+//   <rom_file> [cycles] [input_script]
+// where rom_file is a name or content hash in the catalog with --catalog.
+// A catalog entry brings its quirk profile along, unless --quirks is given;
+// input scripts only contribute their keypad events and seed.
+// Results, one line per job in job-list order:
+//   <job> <rom_file> <frame_buffer_hash> <cycles> <exit_reason>
+
+#define DEFAULT_CYCLES 10000000
+#define MAX_WORKERS 256
+
+struct job_t {
+  char *rom, *input;
+  uint64_t cycles;
+  // results
+  uint64_t hash, executed;
+  const char *reason;
+};
+
+// Consecutive jobs run together; always one job without --simd.
+struct group_t {
+  size_t first, count;
+};
+
+struct deque_t {
+  pthread_mutex_t lock;
+  size_t top, bottom; // [top, bottom) of the group list
+};
+
+struct worker_t {
+  pthread_t thread;
+  size_t id;
+  struct deque_t deque;
+  struct chip8_t *chip8; // LANES instances with --simd
+  struct dynarec_t *dynarec;
+  struct chip8_lanes_t *lanes;
+  // stats
+  size_t jobs, stolen;
+  uint64_t instructions, vector_steps, scalar_steps;
+  double busy;
+};
+
+static struct job_t *jobs;
+static size_t job_count;
+static struct group_t *groups;
+static size_t group_count;
+static int simd;
+static uint64_t seed=DEFAULT_SEED;
+static enum quirks_t quirks;
+static int has_quirks;
+static struct rom_catalog_t catalog;
+static struct worker_t workers[MAX_WORKERS];
+static size_t worker_count;
+static struct run_t defaults={ .core=CORE_INTERPRETER, .ipf=DEFAULT_IPF, .stop_when_idle=1, .skip_idle=1 };
+
+static int pop_bottom(struct deque_t *const deque, size_t *const group) {
+  pthread_mutex_lock(&deque->lock);
+  const int found=deque->top < deque->bottom;
+  if(found) *group=--deque->bottom;
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+static int steal_top(struct deque_t *const deque, size_t *const group) {
+  pthread_mutex_lock(&deque->lock);
+  const int found=deque->top < deque->bottom;
+  if(found) *group=deque->top++;
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+static int next_group(struct worker_t *const worker, size_t *const group) {
+  if(pop_bottom(&worker->deque, group)) return 1;
+  for(size_t offset=1; offset<worker_count; ++offset) {
+    if(steal_top(&workers[(worker->id+offset) % worker_count].deque, group)) {
+      worker->stolen++;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Without a catalog every job reads its ROM file.
+static ssize_t boot_job(struct chip8_t *const chip8, const struct job_t *const job) {
+  const ssize_t size=catalog.image ? catalog_boot(&catalog, chip8, job->rom) : boot(chip8, job->rom);
+  if(size >= 0 && has_quirks) set_quirks(chip8, quirks);
+  return size;
+}
+
+static void run_job(struct worker_t *const worker, struct job_t *const job) {
+  struct run_t config=defaults;
+  struct input_script_t input;
+  if(boot_job(worker->chip8, job) < 0) {
+    job->reason="error";
+    return;
+  }
+  if(job->input) {
+    if(load_input_script(job->input, &input)) {
+      job->reason="error";
+      return;
+    }
+    config.input=&input;
+  }
+  seed_random(worker->chip8, config.input && config.input->has_seed ? config.input->seed : seed);
+  if(config.core == CORE_DYNAREC) {
+    if(worker->dynarec) {
+      config.dynarec=worker->dynarec;
+      dynarec_attach(worker->dynarec, worker->chip8);
+    }
+    else config.core=CORE_INTERPRETER;
+  }
+  job->reason=exit_reason_name(run(&config, worker->chip8, job->cycles, &job->executed));
+  job->hash=frame_buffer_hash(worker->chip8);
+  if(config.input) free_input_script(config.input);
+}
+
+static void run_group(struct worker_t *const worker, const struct group_t *const group) {
+  struct chip8_t *chip8[LANES];
+  struct input_script_t scripts[LANES], *input[LANES];
+  uint64_t cycles[LANES], executed[LANES];
+  enum exit_reason_t reasons[LANES];
+  size_t lane_job[LANES];
+  int count=0;
+  for(size_t j=group->first; j<group->first+group->count; ++j) {
+    struct job_t *const job=jobs+j;
+    chip8[count]=worker->chip8+count;
+    if(boot_job(chip8[count], job) < 0) {
+      job->reason="error";
+      continue;
+    }
+    input[count]=NULL;
+    if(job->input) {
+      if(load_input_script(job->input, scripts+count)) {
+        job->reason="error";
+        continue;
+      }
+      input[count]=scripts+count;
+    }
+    seed_random(chip8[count], input[count] && input[count]->has_seed ? input[count]->seed : seed);
+    cycles[count]=job->cycles;
+    lane_job[count++]=j;
+  }
+  // Every job failed to start.
+  if(!count) return;
+  lanes_init(worker->lanes, chip8, count);
+  run_lanes(&defaults, worker->lanes, input, cycles, executed, reasons);
+  for(int l=0; l<count; ++l) {
+    struct job_t *const job=jobs+lane_job[l];
+    job->executed=executed[l];
+    job->reason=exit_reason_name(reasons[l]);
+    job->hash=frame_buffer_hash(chip8[l]);
+    if(input[l]) free_input_script(input[l]);
+  }
+  worker->vector_steps+=worker->lanes->vector_steps;
+  worker->scalar_steps+=worker->lanes->scalar_steps;
+}
+
+static void *work(void *argument) {
+  struct worker_t *const worker=argument;
+  const double start=now();
+  size_t group;
+  while(next_group(worker, &group)) {
+    const struct group_t *const g=groups+group;
+    if(g->count == 1) run_job(worker, jobs+g->first);
+    else run_group(worker, g);
+    for(size_t job=g->first; job<g->first+g->count; ++job) {
+      worker->jobs++;
+      worker->instructions+=jobs[job].executed;
+    }
+  }
+  worker->busy=now()-start;
+  return NULL;
+}
+
+static int load_jobs(const char *const file_name) {
+  FILE *const file=fopen(file_name, "r");
+  if(!file) return -1;
+  size_t capacity=0;
+  char line[4096];
+  while(fgets(line, sizeof(line), file)) {
+    char *save;
+    char *const rom=strtok_r(line, " \t\n", &save);
+    if(!rom || rom[0] == '#') continue;
+    const char *const cycles=strtok_r(NULL, " \t\n", &save);
+    const char *const input=strtok_r(NULL, " \t\n", &save);
+    if(job_count == capacity) {
+      capacity=capacity ? capacity*2 : 256;
+      struct job_t *const grown=realloc(jobs, capacity*sizeof(struct job_t));
+      if(!grown) {
+        fclose(file);
+        return -1;
+      }
+      jobs=grown;
+    }
+    jobs[job_count++]=(struct job_t){
+      .rom=strdup(rom),
+      .input=input ? strdup(input) : NULL,
+      .cycles=cycles ? strtoull(cycles, NULL, 10) : DEFAULT_CYCLES,
+    };
+  }
+  fclose(file);
+  return 0;
+}
+
+static int group_jobs() {
+  groups=malloc((job_count ? job_count : 1)*sizeof(struct group_t));
+  if(!groups) return -1;
+  for(size_t j=0; j<job_count; ++j) {
+    struct group_t *const last=group_count ? groups+group_count-1 : NULL;
+    if(simd && last && last->count < LANES && !strcmp(jobs[last->first].rom, jobs[j].rom)) last->count++;
+    else groups[group_count++]=(struct group_t){ .first=j, .count=1 };
+  }
+  return 0;
+}
+
+void help() {
+  printf("Help: ./chip8-batch [--threads=N] [--core=interpreter|threaded|dynarec] [--ipf=N] [--seed=N] [--simd] [--catalog=FILE] [--quirks=modern|vip|schip|xochip] [--no-skip-idle] <job_list> [results_file]\n");
+  printf("  job list lines: <rom_file> [cycles] [input_script]\n");
+  printf("  --catalog=FILE  look rom_file up by name or hash in a catalog built with chip8-catalog\n");
+  printf("  --quirks=NAME  quirk profile of every job (default: the catalog's, else modern)\n");
+  printf("  --seed=N  Cxkk seed for jobs whose input script does not set one (default %d)\n", DEFAULT_SEED);
+}
+
+int main(int argc, char **argv) {
+  long threads=sysconf(_SC_NPROCESSORS_ONLN);
+  int arg=1;
+  for(; arg<argc && !strncmp(argv[arg], "--", 2); ++arg) {
+    int unknown=0;
+    if(!strncmp(argv[arg], "--threads=", 10)) threads=strtol(argv[arg]+10, NULL, 10);
+    else if(!strncmp(argv[arg], "--core=", 7)) unknown=parse_core(argv[arg]+7, &defaults.core) || defaults.core == CORE_LOCKSTEP;
+    else if(!strncmp(argv[arg], "--ipf=", 6)) defaults.ipf=strtoull(argv[arg]+6, NULL, 10);
+    else if(!strncmp(argv[arg], "--seed=", 7)) seed=strtoull(argv[arg]+7, NULL, 0);
+    else if(!strcmp(argv[arg], "--simd")) simd=1;
+    else if(!strcmp(argv[arg], "--no-skip-idle")) defaults.skip_idle=0;
+    else if(!strncmp(argv[arg], "--quirks=", 9)) {
+      unknown=parse_quirks(argv[arg]+9, &quirks);
+      has_quirks=1;
+    }
+    else if(!strncmp(argv[arg], "--catalog=", 10)) {
+      if(catalog_open(argv[arg]+10, &catalog)) {
+        fprintf(stderr, "[ERROR] could not open catalog %s\n", argv[arg]+10);
+        exit(80);
+      }
+    }
+    else unknown=1;
+    if(unknown) {
+      fprintf(stderr, "[ERROR] unknown option %s\n", argv[arg]);
+      help();
+      exit(68);
+    }
+  }
+  if(argc-arg < 1 || argc-arg > 2) {
+    fprintf(stderr, "[ERROR] no job list was specified\n");
+    help();
+    exit(68);
+  }
+  if(load_jobs(argv[arg])) {
+    fprintf(stderr, "[ERROR] could not read job list %s\n", argv[arg]);
+    exit(80);
+  }
+  if(simd && !lanes_available()) {
+    fprintf(stderr, "[WARNING] --simd needs AVX2, running jobs one at a time\n");
+    simd=0;
+  }
+  if(group_jobs()) {
+    fprintf(stderr, "[ERROR] out of memory\n");
+    exit(81);
+  }
+  FILE *const out=(argc-arg == 2) ? fopen(argv[arg+1], "w") : stdout;
+  if(!out) {
+    fprintf(stderr, "[ERROR] could not write %s\n", argv[arg+1]);
+    exit(80);
+  }
+  worker_count=threads < 1 ? 1 : threads > MAX_WORKERS ? MAX_WORKERS : (size_t)threads;
+  if(worker_count > group_count && group_count) worker_count=group_count;
+
+  // All the workers' machines come out of one pool, their registers packed
+  // together and their memory in an arena beside them.
+  const size_t per_worker=simd ? LANES : 1;
+  struct chip8_t *const machines=aligned_alloc(_Alignof(struct chip8_t), worker_count*per_worker*sizeof(struct chip8_t));
+  struct chip8_arena_t arena;
+  if(!machines || arena_init(&arena, worker_count*per_worker)) {
+    fprintf(stderr, "[ERROR] out of memory\n");
+    exit(81);
+  }
+  const double start=now();
+  for(size_t w=0; w<worker_count; ++w) {
+    struct worker_t *const worker=workers+w;
+    worker->id=w;
+    worker->deque.top=group_count*w/worker_count;
+    worker->deque.bottom=group_count*(w+1)/worker_count;
+    pthread_mutex_init(&worker->deque.lock, NULL);
+    worker->chip8=machines+w*per_worker;
+    for(size_t m=0; m<per_worker; ++m) arena_attach(&arena, worker->chip8+m);
+    worker->dynarec=defaults.core == CORE_DYNAREC ? dynarec_create() : NULL;
+    worker->lanes=simd ? aligned_alloc(LANES_ALIGN, sizeof(struct chip8_lanes_t)) : NULL;
+    if(simd && !worker->lanes) {
+      fprintf(stderr, "[ERROR] out of memory\n");
+      exit(81);
+    }
+  }
+  for(size_t w=0; w<worker_count; ++w) pthread_create(&workers[w].thread, NULL, work, workers+w);
+  for(size_t w=0; w<worker_count; ++w) pthread_join(workers[w].thread, NULL);
+  const double elapsed=now()-start;
+
+  uint64_t total=0;
+  for(size_t j=0; j<job_count; ++j) {
+    fprintf(out, "%zu %s %016lx %lu %s\n", j, jobs[j].rom, jobs[j].hash, jobs[j].executed, jobs[j].reason);
+    total+=jobs[j].executed;
+  }
+  for(size_t w=0; w<worker_count; ++w) {
+    const struct worker_t *const worker=workers+w;
+    fprintf(stderr, "worker %zu: %zu jobs (%zu stolen), %lu instructions in %.3fs (%.0f IPS)\n",
+            w, worker->jobs, worker->stolen, worker->instructions, worker->busy,
+            worker->busy > 0 ? worker->instructions/worker->busy : 0);
+    if(simd) fprintf(stderr, "worker %zu: %lu vector steps, %lu scalar steps\n", w, worker->vector_steps, worker->scalar_steps);
+    free(worker->lanes);
+    dynarec_destroy(worker->dynarec);
+  }
+  free(machines);
+  arena_free(&arena);
+  fprintf(stderr, "%zu jobs, %lu instructions in %.3fs (%.0f IPS) on %zu workers\n",
+          job_count, total, elapsed, elapsed > 0 ? total/elapsed : 0, worker_count);
+  if(out != stdout) fclose(out);
+  for(size_t j=0; j<job_count; ++j) {
+    free(jobs[j].rom);
+    free(jobs[j].input);
+  }
+  free(jobs);
+  free(groups);
+  catalog_close(&catalog);
+  return EXIT_SUCCESS;
+}
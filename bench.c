@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include "chip8.h"
+#include "dynarec.h"
+#include "runner.h"
+
+// Runs a fixed number of cycles of each ROM on each core several times and
+// reports ns per instruction, instructions per second and their spread, as
+// a table on stderr and as JSON for comparing runs over time. Besides the
+// ROMs on the command line there are synthetic ones that each stress one
+// part of the core. All of them loop forever, so every run executes exactly
+// the requested number of cycles.
+
+#define DEFAULT_BENCH_CYCLES 20000000
+#define DEFAULT_RUNS 5
+#define MAX_RUNS 64
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+// 8xyN arithmetic and logic, one jump per ten instructions.
+static const uint8_t alu_rom[]={
+  0x6A, 0x05, // 200: VA=5
+  0x6B, 0x07, // 202: VB=7
+  0x8A, 0xB4, // 204: VA+=VB
+  0x8B, 0xA5, // 206: VB-=VA
+  0x8A, 0xB1, // 208: VA|=VB
+  0x8A, 0xB2, // 20A: VA&=VB
+  0x8A, 0xB3, // 20C: VA^=VB
+  0x8A, 0xB6, // 20E: VA>>=1
+  0x8B, 0xAE, // 210: VB<<=1
+  0x8A, 0xB7, // 212: VA=VB-VA
+  0x7A, 0x01, // 214: VA+=1
+  0x12, 0x04, // 216: jump 204
+};
+
+// Two 15-row sprites drawn at positions that wander across both edges.
+static const uint8_t sprite_rom[]={
+  0xA0, 0x00, // 200: I=font
+  0xD0, 0x1F, // 202: draw 15 rows at V0,V1
+  0xD1, 0x2A, // 204: draw 10 rows at V1,V2
+  0x70, 0x07, // 206: V0+=7
+  0x71, 0x05, // 208: V1+=5
+  0x72, 0x03, // 20A: V2+=3
+  0x12, 0x02, // 20C: jump 202
+};
+
+// Fx65/Fx55 moving all sixteen registers through ram past the code.
+static const uint8_t memory_rom[]={
+  0xA3, 0x00, // 200: I=300
+  0xFF, 0x65, // 202: V0..VF=[I]
+  0x70, 0x01, // 204: V0+=1
+  0xFF, 0x55, // 206: [I]=V0..VF
+  0x12, 0x02, // 208: jump 202
+};
+
+// Nested calls four deep.
+static const uint8_t call_rom[]={
+  0x22, 0x06, // 200: call 206
+  0x12, 0x00, // 202: jump 200
+  0x00, 0x00, // 204:
+  0x22, 0x0A, // 206: call 20A
+  0x00, 0xEE, // 208: ret
+  0x22, 0x0E, // 20A: call 20E
+  0x00, 0xEE, // 20C: ret
+  0x22, 0x12, // 20E: call 212
+  0x00, 0xEE, // 210: ret
+  0x00, 0xEE, // 212: ret
+};
+
+struct bench_rom_t {
+  const char *name;
+  const uint8_t *code;
+  size_t size;
+};
+
+static const struct bench_rom_t synthetic[]={
+  { "synthetic/alu", alu_rom, sizeof(alu_rom) },
+  { "synthetic/sprites", sprite_rom, sizeof(sprite_rom) },
+  { "synthetic/memory", memory_rom, sizeof(memory_rom) },
+  { "synthetic/calls", call_rom, sizeof(call_rom) },
+};
+
+struct stats_t {
+  double mean, stddev, min;
+};
+
+static struct stats_t stats(const double samples[], int count) {
+  struct stats_t result={ .min=samples[0] };
+  for(int s=0; s<count; ++s) {
+    result.mean+=samples[s];
+    if(samples[s] < result.min) result.min=samples[s];
+  }
+  result.mean/=count;
+  for(int s=0; s<count; ++s) result.stddev+=(samples[s]-result.mean)*(samples[s]-result.mean);
+  result.stddev=count > 1 ? sqrt(result.stddev/(count-1)) : 0;
+  return result;
+}
+
+static void json_string(FILE *const out, const char *string) {
+  fputc('"', out);
+  for(; *string; ++string) {
+    if(*string == '"' || *string == '\\') fputc('\\', out);
+    fputc(*string, out);
+  }
+  fputc('"', out);
+}
+
+static const char *core_name(enum core_t core) {
+  const char *const names[]={ "interpreter", "threaded", "dynarec", "lockstep" };
+  return names[core];
+}
+
+// Attached to memory in main() for measure() and fusion_report().
+static struct chip8_t chip8;
+
+// Seconds taken by each of `runs` runs, booting afresh before each one.
+static void measure(const struct bench_rom_t *const rom, struct run_t *const config, uint64_t cycles, int runs, double seconds[]) {
+  for(int r=0; r<runs; ++r) {
+    boot_rom(&chip8, rom->code, rom->size);
+    if(config->dynarec) dynarec_attach(config->dynarec, &chip8);
+    uint64_t executed;
+    const double start=now();
+    run(config, &chip8, cycles, &executed);
+    seconds[r]=now()-start;
+  }
+}
+
+// Instead of timing: how many dispatches step() saves by fusing, per kind
+// of sequence, over the same frames a timed run goes through. A ROM that
+// parks on a jump to itself with the timers run down is counted up to
+// there, since fusing cannot change anything after that.
+static void fusion_report(const struct bench_rom_t *const rom, uint64_t cycles, uint64_t ipf) {
+  uint64_t fused[FUSION_COUNT]={ 0 };
+  uint64_t done=0, dispatches=0, frame=0;
+  boot_rom(&chip8, rom->code, rom->size);
+  while(done < cycles) {
+    if(fetch(&chip8, chip8.pc) == (0x1000|chip8.pc) && !chip8.dt && !chip8.st) break;
+    const uint64_t budget=ipf && ipf-frame < cycles-done ? ipf-frame : cycles-done;
+    const uint16_t pc=chip8.pc & RAM_MASK;
+    const uint32_t ran=step(&chip8, budget);
+    // step() decodes first, so the kind is only known afterwards.
+    if(ran > 1) fused[chip8.fused[pc]]++;
+    dispatches++;
+    done+=ran;
+    frame+=ran;
+    if(ipf && frame == ipf) {
+      tick_timers(&chip8);
+      frame=0;
+    }
+  }
+  printf("%-22s %10lu instr %10lu dispatches %5.1f%% saved ", rom->name, done, dispatches, done ? 100.0*(done-dispatches)/done : 0);
+  for(int f=1; f<FUSION_COUNT; ++f) printf(" %s=%lu", fusion_name(f), fused[f]);
+  printf("\n");
+}
+
+static const char *const layout_names[]={ "packed", "inline" };
+
+// Hosts `count` machines of one ROM the way a server would, a frame each
+// in turn, and returns the seconds `cycles` instructions took in all. The
+// packed layout keeps their registers in one array and their memory in an
+// arena; inline puts each one's memory right after its registers, as when
+// struct chip8_t held everything.
+static double host(const struct bench_rom_t *const rom, size_t count, uint64_t cycles, uint64_t ipf, int packed) {
+  struct chip8_t **const machines=malloc(count*sizeof(struct chip8_t *));
+  struct chip8_t *const pool=packed ? aligned_alloc(_Alignof(struct chip8_t), count*sizeof(struct chip8_t)) : NULL;
+  struct chip8_arena_t arena={ 0 };
+  if(!machines || (packed && (!pool || arena_init(&arena, count)))) {
+    fprintf(stderr, "[ERROR] out of memory\n");
+    exit(81);
+  }
+  for(size_t m=0; m<count; ++m) {
+    if(packed) {
+      machines[m]=pool+m;
+      arena_attach(&arena, machines[m]);
+    }
+    else {
+      machines[m]=aligned_alloc(_Alignof(struct chip8_t), sizeof(struct chip8_t)+sizeof(struct chip8_memory_t));
+      if(!machines[m]) {
+        fprintf(stderr, "[ERROR] out of memory\n");
+        exit(81);
+      }
+      attach_memory(machines[m], (struct chip8_memory_t *)(machines[m]+1));
+    }
+    boot_rom(machines[m], rom->code, rom->size);
+    seed_random(machines[m], m);
+  }
+  const double start=now();
+  for(uint64_t done=0; done<cycles;)
+    for(size_t m=0; m<count && done<cycles; ++m) {
+      // Not run_frame(): what idle loops and Fx0A waits skip would count as
+      // run without touching memory.
+      const uint64_t frame=ipf < cycles-done ? ipf : cycles-done;
+      run_cycles(machines[m], frame);
+      tick_timers(machines[m]);
+      done+=frame;
+    }
+  const double seconds=now()-start;
+  if(!packed) for(size_t m=0; m<count; ++m) free(machines[m]);
+  arena_free(&arena);
+  free(pool);
+  free(machines);
+  return seconds;
+}
+
+void help() {
+  printf("Help: ./chip8-bench [--core=interpreter|threaded|dynarec]... [--cycles=N] [--runs=N] [--ipf=N] [--json=FILE] [--fusion] [--instances=N [--layout=packed|inline]] [rom_file]...\n");
+  printf("  --core=NAME   core to measure, repeatable (default: all of them)\n");
+  printf("  --cycles=N    instructions per run (default %d)\n", DEFAULT_BENCH_CYCLES);
+  printf("  --runs=N      runs per rom and core (default %d, at most %d)\n", DEFAULT_RUNS, MAX_RUNS);
+  printf("  --json=FILE   where the results go (default stdout)\n");
+  printf("  --fusion      instead of timing, report the dispatches fused sequences save on each rom\n");
+  printf("  --instances=N instead, run N interpreter instances of each rom a frame at a time, with their\n");
+  printf("                memory in an arena apart from the registers and inline with them\n");
+  printf("  --layout=NAME only time one of the two, e.g. under perf stat\n");
+}
+
+int main(int argc, char **argv) {
+  static uint8_t buffers[64][MAX_ROM_SIZE];
+  struct bench_rom_t roms[sizeof(synthetic)/sizeof(synthetic[0])+64];
+  size_t rom_count=0;
+  enum core_t cores[3];
+  size_t core_count=0;
+  uint64_t cycles=DEFAULT_BENCH_CYCLES;
+  int runs=DEFAULT_RUNS;
+  uint64_t ipf=DEFAULT_IPF;
+  const char *json=NULL;
+  int fusion=0;
+  size_t instances=0;
+  int layouts[2]={ 1, 1 };
+  int arg=1;
+  for(; arg<argc && !strncmp(argv[arg], "--", 2); ++arg) {
+    int unknown=0;
+    if(!strncmp(argv[arg], "--core=", 7)) {
+      enum core_t core;
+      unknown=parse_core(argv[arg]+7, &core) || core == CORE_LOCKSTEP || core_count == 3;
+      if(!unknown) cores[core_count++]=core;
+    }
+    else if(!strncmp(argv[arg], "--cycles=", 9)) cycles=strtoull(argv[arg]+9, NULL, 10);
+    else if(!strncmp(argv[arg], "--runs=", 7)) runs=strtol(argv[arg]+7, NULL, 10);
+    else if(!strncmp(argv[arg], "--ipf=", 6)) ipf=strtoull(argv[arg]+6, NULL, 10);
+    else if(!strncmp(argv[arg], "--json=", 7)) json=argv[arg]+7;
+    else if(!strcmp(argv[arg], "--fusion")) fusion=1;
+    else if(!strncmp(argv[arg], "--instances=", 12)) instances=strtoull(argv[arg]+12, NULL, 10);
+    else if(!strncmp(argv[arg], "--layout=", 9)) {
+      unknown=1;
+      for(int l=0; l<2; ++l) {
+        layouts[l]=!strcmp(argv[arg]+9, layout_names[l]);
+        if(layouts[l]) unknown=0;
+      }
+    }
+    else unknown=1;
+    if(unknown) {
+      fprintf(stderr, "[ERROR] unknown option %s\n", argv[arg]);
+      help();
+      exit(68);
+    }
+  }
+  if(runs < 1 || runs > MAX_RUNS || !cycles || argc-arg > 64) {
+    fprintf(stderr, "[ERROR] need 1 to %d runs, a cycle count and at most 64 roms\n", MAX_RUNS);
+    help();
+    exit(68);
+  }
+  if(!core_count) {
+    cores[core_count++]=CORE_INTERPRETER;
+    cores[core_count++]=CORE_THREADED;
+    cores[core_count++]=CORE_DYNAREC;
+  }
+  for(size_t s=0; s<sizeof(synthetic)/sizeof(synthetic[0]); ++s) roms[rom_count++]=synthetic[s];
+  for(int r=0; arg+r<argc; ++r) {
+    const ssize_t size=read_file(argv[arg+r], buffers[r], MAX_ROM_SIZE);
+    if(size < 0) {
+      fprintf(stderr, "[ERROR] could not read rom %s\n", argv[arg+r]);
+      exit(80);
+    }
+    roms[rom_count++]=(struct bench_rom_t){ argv[arg+r], buffers[r], size };
+  }
+  if(instances) {
+    const uint64_t frame=ipf ? ipf : DEFAULT_IPF;
+    for(size_t r=0; r<rom_count; ++r)
+      for(int l=0; l<2; ++l) {
+        if(!layouts[l]) continue;
+        const double seconds=host(roms+r, instances, cycles, frame, !l);
+        fprintf(stderr, "%-22s %-7s %7.3f ns/instr %12.0f IPS\n", roms[r].name, layout_names[l], seconds*1e9/cycles, seconds > 0 ? cycles/seconds : 0);
+      }
+    return EXIT_SUCCESS;
+  }
+  struct chip8_arena_t arena;
+  if(arena_init(&arena, 1)) {
+    fprintf(stderr, "[ERROR] out of memory\n");
+    exit(81);
+  }
+  arena_attach(&arena, &chip8);
+  if(fusion) {
+    for(size_t r=0; r<rom_count; ++r) fusion_report(roms+r, cycles, ipf);
+    arena_free(&arena);
+    return EXIT_SUCCESS;
+  }
+  FILE *const out=json ? fopen(json, "w") : stdout;
+  if(!out) {
+    fprintf(stderr, "[ERROR] could not write %s\n", json);
+    exit(80);
+  }
+
+  struct dynarec_t *const dynarec=dynarec_create();
+  fprintf(out, "{\n  \"revision\": ");
+  json_string(out, BENCH_REVISION);
+  fprintf(out, ",\n  \"compiler\": ");
+  json_string(out, __VERSION__);
+  fprintf(out, ",\n  \"time\": %ld,\n  \"cycles\": %lu,\n  \"runs\": %d,\n  \"ipf\": %lu,\n  \"results\": [", (long)time(NULL), cycles, runs, ipf);
+  int first=1;
+  for(size_t c=0; c<core_count; ++c) {
+    struct run_t config={ .core=cores[c], .ipf=ipf };
+    if(cores[c] == CORE_DYNAREC) {
+      if(!dynarec) {
+        fprintf(stderr, "[WARNING] dynarec unavailable, skipping it\n");
+        continue;
+      }
+      config.dynarec=dynarec;
+    }
+    for(size_t r=0; r<rom_count; ++r) {
+      double seconds[MAX_RUNS], ns[MAX_RUNS], ips[MAX_RUNS];
+      measure(roms+r, &config, cycles, runs, seconds);
+      for(int k=0; k<runs; ++k) {
+        ns[k]=seconds[k]*1e9/cycles;
+        ips[k]=seconds[k] > 0 ? cycles/seconds[k] : 0;
+      }
+      const struct stats_t ns_stats=stats(ns, runs), ips_stats=stats(ips, runs);
+      fprintf(stderr, "%-22s %-11s %7.3f ns/instr %12.0f IPS  +-%.1f%%\n", roms[r].name, core_name(cores[c]),
+              ns_stats.mean, ips_stats.mean, ns_stats.mean > 0 ? 100*ns_stats.stddev/ns_stats.mean : 0);
+      fprintf(out, "%s\n    { \"rom\": ", first ? "" : ",");
+      json_string(out, roms[r].name);
+      fprintf(out, ", \"core\": \"%s\",\n      \"ns_per_instr\": { \"mean\": %.4f, \"stddev\": %.4f, \"min\": %.4f },\n"
+              "      \"ips\": { \"mean\": %.0f, \"stddev\": %.0f },\n      \"seconds\": [",
+              core_name(cores[c]), ns_stats.mean, ns_stats.stddev, ns_stats.min, ips_stats.mean, ips_stats.stddev);
+      for(int k=0; k<runs; ++k) fprintf(out, "%s%.6f", k ? ", " : "", seconds[k]);
+      fprintf(out, "] }");
+      first=0;
+    }
+  }
+  fprintf(out, "\n  ]\n}\n");
+  if(out != stdout) fclose(out);
+  dynarec_destroy(dynarec);
+  arena_free(&arena);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "chip8.h"
+#include "catalog.h"
+
+static uint64_t fnv1a(const void *const data, size_t size) {
+  const uint8_t *const bytes=data;
+  uint64_t hash=0xcbf29ce484222325;
+  for(size_t at=0; at<size; ++at) {
+    hash^=bytes[at];
+    hash*=0x100000001b3;
+  }
+  return hash;
+}
+
+uint64_t rom_hash(const uint8_t *const rom, size_t size) {
+  return fnv1a(rom, size);
+}
+
+static uint32_t table_size(size_t count) {
+  uint32_t slots=2;
+  while(slots < 2*count) slots*=2;
+  return slots;
+}
+
+static int valid(const struct rom_catalog_t *const catalog) {
+  const struct catalog_header_t *const header=catalog->header;
+  if(memcmp(header->magic, CATALOG_MAGIC, 4) || header->version != CATALOG_VERSION) return 0;
+  if(!header->rom_slots || (header->rom_slots & (header->rom_slots-1))
+     || !header->name_slots || (header->name_slots & (header->name_slots-1)))
+    return 0;
+  const uint64_t tables=sizeof(*header)
+    +(uint64_t)header->rom_slots*sizeof(struct catalog_rom_t)
+    +(uint64_t)header->name_slots*sizeof(struct catalog_name_t);
+  if(header->names_offset != tables || header->data_offset < header->names_offset || header->data_offset > catalog->size)
+    return 0;
+  // Every name ends before the ROM bytes start.
+  if(header->data_offset > header->names_offset && catalog->image[header->data_offset-1]) return 0;
+  // Probing stops at a free slot, so there has to be one.
+  uint32_t used=0;
+  for(uint32_t slot=0; slot<header->rom_slots; ++slot) {
+    const struct catalog_rom_t *const rom=catalog->roms+slot;
+    if(!rom->offset) continue;
+    if(rom->offset < header->data_offset || rom->size > MAX_ROM_SIZE || (uint64_t)rom->offset+rom->size > catalog->size
+       || rom->quirks >= QUIRKS_COUNT)
+      return 0;
+    used++;
+  }
+  if(used == header->rom_slots) return 0;
+  used=0;
+  for(uint32_t slot=0; slot<header->name_slots; ++slot) {
+    const struct catalog_name_t *const name=catalog->names+slot;
+    if(name->rom == UINT32_MAX) continue;
+    if(name->rom >= header->rom_slots || !catalog->roms[name->rom].offset
+       || name->name >= header->data_offset-header->names_offset)
+      return 0;
+    used++;
+  }
+  return used < header->name_slots;
+}
+
+int catalog_open(const char *const file_name, struct rom_catalog_t *const catalog) {
+  memset(catalog, 0, sizeof(*catalog));
+  const int fd=open(file_name, O_RDONLY);
+  if(fd == -1) return -1;
+  struct stat info;
+  if(fstat(fd, &info) || (size_t)info.st_size < sizeof(struct catalog_header_t)) {
+    close(fd);
+    return -1;
+  }
+  void *const image=mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(image == MAP_FAILED) return -1;
+  catalog->image=image;
+  catalog->size=info.st_size;
+  catalog->header=image;
+  catalog->roms=(const struct catalog_rom_t *)(catalog->header+1);
+  catalog->names=(const struct catalog_name_t *)(catalog->roms+catalog->header->rom_slots);
+  if(!valid(catalog)) {
+    catalog_close(catalog);
+    return -1;
+  }
+  return 0;
+}
+
+void catalog_close(struct rom_catalog_t *const catalog) {
+  if(catalog->image) munmap((void *)catalog->image, catalog->size);
+  memset(catalog, 0, sizeof(*catalog));
+}
+
+static const struct catalog_rom_t *find_hash(const struct rom_catalog_t *const catalog, uint64_t hash) {
+  const uint32_t mask=catalog->header->rom_slots-1;
+  for(uint32_t slot=hash & mask;; slot=(slot+1) & mask) {
+    const struct catalog_rom_t *const rom=catalog->roms+slot;
+    if(!rom->offset) return NULL;
+    if(rom->hash == hash) return rom;
+  }
+}
+
+static const struct catalog_rom_t *find_name(const struct rom_catalog_t *const catalog, const char *const key) {
+  const char *const strings=(const char *)catalog->image+catalog->header->names_offset;
+  const uint64_t hash=fnv1a(key, strlen(key));
+  const uint32_t mask=catalog->header->name_slots-1;
+  for(uint32_t slot=hash & mask;; slot=(slot+1) & mask) {
+    const struct catalog_name_t *const name=catalog->names+slot;
+    if(name->rom == UINT32_MAX) return NULL;
+    if(name->hash == hash && !strcmp(strings+name->name, key)) return catalog->roms+name->rom;
+  }
+}
+
+static const struct catalog_rom_t *find(const struct rom_catalog_t *const catalog, const char *const key) {
+  const struct catalog_rom_t *rom=find_name(catalog, key);
+  if(!rom && strlen(key) == 16) {
+    char *end;
+    const uint64_t hash=strtoull(key, &end, 16);
+    if(!*end) rom=find_hash(catalog, hash);
+  }
+  return rom;
+}
+
+const uint8_t *catalog_find(const struct rom_catalog_t *const catalog, const char *const key, size_t *const size) {
+  const struct catalog_rom_t *const rom=find(catalog, key);
+  if(!rom) return NULL;
+  *size=rom->size;
+  return catalog->image+rom->offset;
+}
+
+ssize_t catalog_boot(const struct rom_catalog_t *const catalog, struct chip8_t *const chip8, const char *const key) {
+  const struct catalog_rom_t *const rom=find(catalog, key);
+  if(!rom) return -1;
+  boot_rom(chip8, catalog->image+rom->offset, rom->size);
+  set_quirks(chip8, rom->quirks);
+  return rom->size;
+}
+
+int catalog_write(const char *const file_name, const struct catalog_entry_t entries[], size_t count) {
+  struct catalog_header_t header={
+    .magic=CATALOG_MAGIC,
+    .version=CATALOG_VERSION,
+    .rom_slots=table_size(count),
+    .name_slots=table_size(count),
+  };
+  struct catalog_rom_t *const roms=calloc(header.rom_slots, sizeof(struct catalog_rom_t));
+  struct catalog_name_t *const names=malloc(header.name_slots*sizeof(struct catalog_name_t));
+  uint32_t *const rom_of=malloc((count ? count : 1)*sizeof(uint32_t));
+  size_t names_size=0, data_size=0;
+  for(size_t e=0; e<count; ++e) {
+    names_size+=strlen(entries[e].name)+1;
+    data_size+=entries[e].size;
+  }
+  char *const strings=malloc(names_size ? names_size : 1);
+  uint8_t *const data=malloc(data_size ? data_size : 1);
+  int status=(!roms || !names || !rom_of || !strings || !data) ? -1 : 0;
+  if(!status) for(uint32_t slot=0; slot<header.name_slots; ++slot) names[slot].rom=UINT32_MAX;
+
+  // Names first, since their total size decides where the ROM bytes go.
+  names_size=0;
+  for(size_t e=0; !status && e<count; ++e) {
+    const size_t length=strlen(entries[e].name);
+    const uint64_t hash=fnv1a(entries[e].name, length);
+    const uint32_t mask=header.name_slots-1;
+    uint32_t slot=hash & mask;
+    while(names[slot].rom != UINT32_MAX && (names[slot].hash != hash || strcmp(strings+names[slot].name, entries[e].name)))
+      slot=(slot+1) & mask;
+    if(names[slot].rom != UINT32_MAX) continue;
+    names[slot]=(struct catalog_name_t){ .hash=hash, .name=names_size, .rom=e };
+    memcpy(strings+names_size, entries[e].name, length+1);
+    names_size+=length+1;
+    header.name_count++;
+  }
+  header.names_offset=sizeof(header)
+    +header.rom_slots*sizeof(struct catalog_rom_t)
+    +header.name_slots*sizeof(struct catalog_name_t);
+  const uint64_t data_offset=header.names_offset+names_size;
+  if(data_offset+data_size > UINT32_MAX) status=-1;
+  header.data_offset=data_offset;
+
+  data_size=0;
+  for(size_t e=0; !status && e<count; ++e) {
+    const struct catalog_entry_t *const entry=entries+e;
+    if(entry->size > MAX_ROM_SIZE || entry->quirks >= QUIRKS_COUNT) {
+      status=-1;
+      break;
+    }
+    const uint64_t hash=rom_hash(entry->rom, entry->size);
+    const uint32_t mask=header.rom_slots-1;
+    uint32_t slot=hash & mask;
+    while(roms[slot].offset && roms[slot].hash != hash) slot=(slot+1) & mask;
+    if(roms[slot].offset) {
+      const uint8_t *const stored=data+(roms[slot].offset-header.data_offset);
+      if(roms[slot].size != entry->size || memcmp(stored, entry->rom, entry->size)) status=-1;
+    }
+    else {
+      roms[slot]=(struct catalog_rom_t){ .hash=hash, .offset=header.data_offset+data_size, .size=entry->size, .quirks=entry->quirks };
+      memcpy(data+data_size, entry->rom, entry->size);
+      data_size+=entry->size;
+      header.rom_count++;
+    }
+    rom_of[e]=slot;
+  }
+  for(uint32_t slot=0; !status && slot<header.name_slots; ++slot)
+    if(names[slot].rom != UINT32_MAX) names[slot].rom=rom_of[names[slot].rom];
+
+  FILE *const file=status ? NULL : fopen(file_name, "wb");
+  if(!file) status=-1;
+  else {
+    if(fwrite(&header, sizeof(header), 1, file) != 1
+       || fwrite(roms, sizeof(struct catalog_rom_t), header.rom_slots, file) != header.rom_slots
+       || fwrite(names, sizeof(struct catalog_name_t), header.name_slots, file) != header.name_slots
+       || fwrite(strings, 1, names_size, file) != names_size
+       || fwrite(data, 1, data_size, file) != data_size)
+      status=-1;
+    if(fclose(file)) status=-1;
+  }
+  free(roms);
+  free(names);
+  free(rom_of);
+  free(strings);
+  free(data);
+  return status;
+}
@@ -0,0 +1,80 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "chip8.h"
+
+// A ROM catalog packs any number of ROMs into one file that is mapped once,
+// so booting one is a hash lookup and a copy out of the page cache instead
+// of open/fstat/read/close per job. ROMs are stored once per content and can
+// be looked up by the name they were added under or by their content hash
+// (16 hex digits, as listed by chip8-catalog --list). Each ROM also
+// records the quirk profile it is meant for, which booting it applies.
+// Layout, host byte order:
+//   struct catalog_header_t
+//   rom_slots x struct catalog_rom_t, open addressing on the content hash
+//   name_slots x struct catalog_name_t, open addressing on the name hash
+//   NUL-terminated names
+//   ROM bytes
+// Both tables are powers of two at most half full. Hashes are FNV-1a.
+
+#define CATALOG_MAGIC "C8RC"
+#define CATALOG_VERSION 2
+
+struct catalog_header_t {
+  char magic[4];
+  uint16_t version, reserved;
+  uint32_t rom_slots, name_slots;
+  uint32_t rom_count, name_count;
+  uint32_t names_offset, data_offset;
+};
+
+struct catalog_rom_t {
+  uint64_t hash;
+  uint32_t offset; // 0 for a free slot
+  uint16_t size;
+  uint8_t quirks; // enum quirks_t
+  uint8_t reserved;
+};
+
+struct catalog_name_t {
+  uint64_t hash;
+  uint32_t name; // offset from names_offset
+  uint32_t rom; // slot in the rom table, UINT32_MAX for a free slot
+};
+
+struct rom_catalog_t {
+  const uint8_t *image;
+  size_t size;
+  const struct catalog_header_t *header;
+  const struct catalog_rom_t *roms;
+  const struct catalog_name_t *names;
+};
+
+// What catalog_write() packs.
+struct catalog_entry_t {
+  const char *name;
+  const uint8_t *rom;
+  size_t size;
+  enum quirks_t quirks;
+};
+
+uint64_t rom_hash(const uint8_t *const rom, size_t size);
+// Returns -1 if the file cannot be mapped or is not a valid catalog.
+int catalog_open(const char *const file_name, struct rom_catalog_t *const catalog);
+void catalog_close(struct rom_catalog_t *const catalog);
+// Looks `key` up as a name, then as a content hash. Returns a pointer into
+// the mapping, or NULL.
+const uint8_t *catalog_find(const struct rom_catalog_t *const catalog, const char *const key, size_t *const size);
+// boot() for a ROM in the catalog, followed by set_quirks() with its
+// profile.
+ssize_t catalog_boot(const struct rom_catalog_t *const catalog, struct chip8_t *const chip8, const char *const key);
+// Duplicate contents are stored once, with the profile of their first
+// entry, and duplicate names keep their first ROM. Returns -1 on I/O
+// errors, oversized ROMs, unknown profiles or a hash collision.
+int catalog_write(const char *const file_name, const struct catalog_entry_t entries[], size_t count);
+
+#endif
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "catalog.h"
+
+// Builds a ROM catalog out of ROM files, each added under the path it was
+// given as, or lists what a catalog holds. A single "-" reads the paths
+// from stdin, one per line, for lists too long for a command line; a line
+// may end in a tab and the quirk profile of that ROM.
+
+void help() {
+  printf("Help: ./chip8-catalog [--quirks=modern|vip|schip|xochip] <catalog_file> <rom_file>...|-\n");
+  printf("      ./chip8-catalog --list <catalog_file>\n");
+  printf("  --quirks=NAME  profile of the roms that do not name their own (default modern)\n");
+}
+
+int list(const char *const file_name) {
+  struct rom_catalog_t catalog;
+  if(catalog_open(file_name, &catalog)) {
+    fprintf(stderr, "[ERROR] could not open catalog %s\n", file_name);
+    return 80;
+  }
+  const char *const strings=(const char *)catalog.image+catalog.header->names_offset;
+  for(uint32_t slot=0; slot<catalog.header->name_slots; ++slot) {
+    const struct catalog_name_t *const name=catalog.names+slot;
+    if(name->rom == UINT32_MAX) continue;
+    const struct catalog_rom_t *const rom=catalog.roms+name->rom;
+    printf("%016lx %5u %-6s %s\n", rom->hash, rom->size, quirks_name(rom->quirks), strings+name->name);
+  }
+  fprintf(stderr, "%u names, %u distinct roms, %zu bytes\n", catalog.header->name_count, catalog.header->rom_count, catalog.size);
+  catalog_close(&catalog);
+  return EXIT_SUCCESS;
+}
+
+// Returns the number of paths read, with *paths pointing at them and
+// *profiles at their quirks, `quirks` where a line names none.
+size_t read_paths(FILE *const file, char ***const paths, enum quirks_t **const profiles, enum quirks_t quirks) {
+  size_t count=0, capacity=0;
+  char line[4096];
+  *paths=NULL;
+  *profiles=NULL;
+  while(fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "\n")]='\0';
+    if(!line[0]) continue;
+    if(count == capacity) {
+      capacity=capacity ? capacity*2 : 1024;
+      *paths=realloc(*paths, capacity*sizeof(char *));
+      *profiles=realloc(*profiles, capacity*sizeof(enum quirks_t));
+    }
+    (*profiles)[count]=quirks;
+    char *const tab=strchr(line, '\t');
+    if(tab) {
+      *tab='\0';
+      if(parse_quirks(tab+1, *profiles+count)) {
+        fprintf(stderr, "[ERROR] unknown quirk profile %s for %s\n", tab+1, line);
+        exit(68);
+      }
+    }
+    if(!*paths || !*profiles || !((*paths)[count++]=strdup(line))) {
+      fprintf(stderr, "[ERROR] out of memory\n");
+      exit(81);
+    }
+  }
+  return count;
+}
+
+int main(int argc, char **argv) {
+  if(argc == 3 && !strcmp(argv[1], "--list")) return list(argv[2]);
+  enum quirks_t quirks=QUIRKS_modern;
+  int arg=1;
+  if(arg < argc && !strncmp(argv[arg], "--quirks=", 9)) {
+    if(parse_quirks(argv[arg]+9, &quirks)) {
+      fprintf(stderr, "[ERROR] unknown option %s\n", argv[arg]);
+      help();
+      exit(68);
+    }
+    ++arg;
+  }
+  if(argc-arg < 2 || !strncmp(argv[arg], "--", 2)) {
+    fprintf(stderr, "[ERROR] need a catalog file and at least one rom\n");
+    help();
+    exit(68);
+  }
+  const char *const catalog_file=argv[arg];
+  char **paths=argv+arg+1;
+  size_t count=argc-arg-1;
+  enum quirks_t *profiles=NULL;
+  if(count == 1 && !strcmp(paths[0], "-")) count=read_paths(stdin, &paths, &profiles, quirks);
+  struct catalog_entry_t *const entries=malloc(count*sizeof(struct catalog_entry_t));
+  if(!entries && count) {
+    fprintf(stderr, "[ERROR] out of memory\n");
+    exit(81);
+  }
+  for(size_t r=0; r<count; ++r) {
+    uint8_t buffer[MAX_ROM_SIZE];
+    const ssize_t size=read_file(paths[r], buffer, sizeof(buffer));
+    if(size < 0) {
+      fprintf(stderr, "[ERROR] could not read rom %s\n", paths[r]);
+      exit(80);
+    }
+    uint8_t *const rom=malloc(size ? size : 1);
+    if(!rom) {
+      fprintf(stderr, "[ERROR] out of memory\n");
+      exit(81);
+    }
+    memcpy(rom, buffer, size);
+    entries[r]=(struct catalog_entry_t){ .name=paths[r], .rom=rom, .size=size, .quirks=profiles ? profiles[r] : quirks };
+  }
+  if(catalog_write(catalog_file, entries, count)) {
+    fprintf(stderr, "[ERROR] could not write catalog %s\n", catalog_file);
+    exit(80);
+  }
+  for(size_t r=0; r<count; ++r) free((void *)entries[r].rom);
+  free(entries);
+  return EXIT_SUCCESS;
+}
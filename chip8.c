@@ -0,0 +1,724 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "chip8.h"
+#include "trace.h"
+#include "profile.h"
+#include "ops.h"
+
+void set_pixel(uint64_t rows[2][HIRES_HEIGHT], uint16_t pos_x, uint16_t pos_y, uint8_t bit) {
+  trace_printf("%d %d %d\n", pos_x, pos_y, (pos_y*(PIXELS_PER_ROW))+pos_x);
+  if(bit) rows[pos_x >> 6][pos_y]|=PIXEL_MASK(pos_x);
+  else rows[pos_x >> 6][pos_y]&=~PIXEL_MASK(pos_x);
+}
+
+void invert_pixel(uint64_t rows[2][HIRES_HEIGHT], uint16_t pos_x, uint16_t pos_y) {
+  trace_printf("%d %d %d\n", pos_x, pos_y, (pos_y*(PIXELS_PER_ROW))+pos_x);
+  rows[pos_x >> 6][pos_y]^=PIXEL_MASK(pos_x);
+}
+
+ssize_t read_file(const char *const file_name, uint8_t *const buffer, size_t capacity) {
+  const int fd=open(file_name, O_RDONLY);
+  if(fd == -1) return -1;
+  struct stat info;
+  ssize_t size=-1;
+  if(!fstat(fd, &info) && (size_t)info.st_size <= capacity) {
+    size=0;
+    while(size < info.st_size) {
+      const ssize_t bytes_read=read(fd, buffer+size, info.st_size-size);
+      if(bytes_read <= 0) {
+        size=-1;
+        break;
+      }
+      size+=bytes_read;
+    }
+  }
+  close(fd);
+  return size;
+}
+
+#define ARENA_PAGE 4096
+#define ARENA_SLOT_SIZE ((sizeof(struct chip8_memory_t)+ARENA_PAGE-1)/ARENA_PAGE*ARENA_PAGE)
+
+int arena_init(struct chip8_arena_t *const arena, size_t count) {
+  arena->slots=aligned_alloc(ARENA_PAGE, (count ? count : 1)*ARENA_SLOT_SIZE);
+  arena->count=count;
+  arena->used=0;
+  return arena->slots ? 0 : -1;
+}
+
+void arena_free(struct chip8_arena_t *const arena) {
+  free(arena->slots);
+  arena->slots=NULL;
+  arena->count=arena->used=0;
+}
+
+int arena_attach(struct chip8_arena_t *const arena, struct chip8_t *const chip8) {
+  if(arena->used == arena->count) return -1;
+  attach_memory(chip8, (struct chip8_memory_t *)(arena->slots+arena->used++*ARENA_SLOT_SIZE));
+  return 0;
+}
+
+void attach_memory(struct chip8_t *const chip8, struct chip8_memory_t *const memory) {
+  chip8->ram=memory->ram;
+  chip8->fused=memory->fused;
+  chip8->frame_buffer=memory->frame_buffer;
+  chip8->decoded=memory->decoded;
+}
+
+void copy_state(struct chip8_t *const to, const struct chip8_t *const from) {
+  uint8_t *const ram=to->ram, *const fused=to->fused;
+  uint64_t (*const frame_buffer)[HIRES_HEIGHT]=to->frame_buffer;
+  struct instruction_t *const decoded=to->decoded;
+  *to=*from;
+  to->ram=ram;
+  to->fused=fused;
+  to->frame_buffer=frame_buffer;
+  to->decoded=decoded;
+  memcpy(to->ram, from->ram, RAM_SIZE);
+  memcpy(to->fused, from->fused, RAM_SIZE);
+  memcpy(to->frame_buffer, from->frame_buffer, FRAME_BUFFER_SIZE);
+  memcpy(to->decoded, from->decoded, RAM_SIZE*sizeof(struct instruction_t));
+}
+
+ssize_t boot(struct chip8_t *const chip8, const char *const rom_name) {
+  uint8_t buffer[MAX_ROM_SIZE];
+  const ssize_t bytes=read_file(rom_name, buffer, sizeof(buffer));
+  if(bytes >= 0) boot_rom(chip8, buffer, bytes);
+  return bytes;
+}
+
+void boot_rom(struct chip8_t *const chip8, const uint8_t *const rom, size_t size) {
+  //chip8->pc=chip8->memory+ORG;
+  // A reused instance must not carry anything over from its last ROM.
+  memset(chip8->v, 0, sizeof(chip8->v));
+  memset(chip8->stack, 0, sizeof(chip8->stack));
+  memset(chip8->ram, 0, RAM_SIZE);
+  chip8->i=0;
+  chip8->pc=ORG;
+  chip8->sp=0;
+  chip8->dt=chip8->st=0;
+  memset(chip8->frame_buffer, 0, FRAME_BUFFER_SIZE);
+  chip8->hires=0;
+  chip8->quirks=QUIRKS_modern;
+  chip8->draw=1;
+  chip8->keys=0;
+  chip8->waiting=0;
+  seed_random(chip8, DEFAULT_SEED);
+  uint8_t fonts[5*16] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+  };
+  memcpy(chip8->ram, fonts, sizeof(fonts));
+  uint8_t big_fonts[10*16] = {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+  };
+  memcpy(chip8->ram+BIG_FONT, big_fonts, sizeof(big_fonts));
+
+  if(size > RAM_SIZE-ORG) size=RAM_SIZE-ORG;
+  memmove(chip8->ram+ORG, rom, size);
+  for(size_t at=0; at<RAM_SIZE; ++at) chip8->decoded[at].exec=decode_and_exec;
+  memset(chip8->fused, FUSED_undecoded, RAM_SIZE);
+  chip8->on_write=NULL;
+  chip8->on_write_context=NULL;
+}
+
+// splitmix64 spreads the seed over the whole state, which xoshiro needs to
+// be non-zero.
+void seed_random(struct chip8_t *const chip8, uint64_t seed) {
+  for(int word=0; word<4; word+=2) {
+    uint64_t z=(seed+=0x9E3779B97F4A7C15ull);
+    z=(z ^ (z >> 30))*0xBF58476D1CE4E5B9ull;
+    z=(z ^ (z >> 27))*0x94D049BB133111EBull;
+    z^=z >> 31;
+    chip8->rng[word]=z;
+    chip8->rng[word+1]=z >> 32;
+  }
+}
+
+uint16_t get_4_bits(uint16_t instruction, uint8_t start_bit, uint8_t size) {
+  return (instruction >> ((start_bit-1)*4)) & (0xFFFF >> (4-size)*4);
+}
+
+void exec_op_0(struct chip8_t *chip8, const struct instruction_t *op) {
+  if(op->nnn == 0x0e0) {
+    op_00e0(chip8);
+    trace_printf("cls\n");
+  }
+  else if(op->nnn == 0x0ee) {
+    op_00ee(chip8);
+    trace_printf("ret\n");
+  }
+  else if((op->nnn & 0xFF0) == 0x0c0) {
+    op_00cn(chip8, op->n);
+    trace_printf("scd %d\n", op->n);
+  }
+  else if(op->nnn == 0x0fb) {
+    op_00fb(chip8);
+    trace_printf("scr\n");
+  }
+  else if(op->nnn == 0x0fc) {
+    op_00fc(chip8);
+    trace_printf("scl\n");
+  }
+  else if(op->nnn == 0x0fd) {
+    op_00fd(chip8);
+    trace_printf("exit\n");
+  }
+  else if(op->nnn == 0x0fe) {
+    op_00fe(chip8);
+    trace_printf("low\n");
+  }
+  else if(op->nnn == 0x0ff) {
+    op_00ff(chip8);
+    trace_printf("high\n");
+  }
+  else {
+    op_0nnn(chip8, op->nnn);
+    trace_printf("sys 0x%04X\n", chip8->pc);
+  }
+}
+
+void exec_op_1(struct chip8_t *chip8, const struct instruction_t *op) {
+  op_1nnn(chip8, op->nnn);
+  trace_printf("jp 0x%04X\n", chip8->pc);
+}
+
+void exec_op_2(struct chip8_t *chip8, const struct instruction_t *op) {
+  op_2nnn(chip8, op->nnn);
+  trace_printf("call %d\n", chip8->pc);
+}
+
+void exec_op_3(struct chip8_t *chip8, const struct instruction_t *op) {
+  op_3xkk(chip8, op->x, op->kk);
+  trace_printf("se V%d, 0x%04X\n", op->x, op->kk);
+}
+
+void exec_op_4(struct chip8_t *chip8, const struct instruction_t *op) {
+  op_4xkk(chip8, op->x, op->kk);
+  trace_printf("sne V%d, 0x%04X\n", op->x, op->kk);
+}
+
+void exec_op_5(struct chip8_t *chip8, const struct instruction_t *op) {
+  op_5xy0(chip8, op->x, op->y);
+  trace_printf("se V%d, V%d\n", op->x, op->y);
+}
+
+void exec_op_6(struct chip8_t *chip8, const struct instruction_t *op) {
+  op_6xkk(chip8, op->x, op->kk);
+  trace_printf("ld V%d, 0x%04X\n", op->x, op->kk);
+}
+
+void exec_op_7(struct chip8_t *chip8, const struct instruction_t *op) {
+  op_7xkk(chip8, op->x, op->kk);
+  trace_printf("add V%d, 0x%04X\n", op->x, op->kk);
+}
+
+static inline void exec_op_8(struct chip8_t *chip8, const struct instruction_t *op, const int shift_vx) {
+  const uint8_t register_x=op->x;
+  const uint8_t register_y=op->y;
+  switch(op->n) {
+  case 0:
+    op_8xy0(chip8, register_x, register_y);
+    trace_printf("ld V%d, V%d\n", register_x, register_y);
+    break;
+  case 1:
+    op_8xy1(chip8, register_x, register_y);
+    trace_printf("or V%d, V%d\n", register_x, register_y);
+    break;
+  case 2:
+    op_8xy2(chip8, register_x, register_y);
+    trace_printf("and V%d, V%d\n", register_x, register_y);
+    break;
+  case 3:
+    op_8xy3(chip8, register_x, register_y);
+    trace_printf("xor V%d, V%d\n", register_x, register_y);
+    break;
+  case 4:
+    op_8xy4(chip8, register_x, register_y);
+    trace_printf("add V%d, V%d\n", register_x, register_y);
+    break;
+  case 5:
+    op_8xy5(chip8, register_x, register_y);
+    trace_printf("sub V%d, V%d\n", register_x, register_y);
+    break;
+  case 6:
+    op_8xy6(chip8, register_x, register_y, shift_vx);
+    trace_printf("shr V%d(%d)\n", register_x, chip8->v[register_x]);
+    break;
+  case 7:
+    op_8xy7(chip8, register_x, register_y);
+    trace_printf("subn V%d, V%d\n", register_x, register_y);
+    break;
+  case 0xe:
+    op_8xye(chip8, register_x, register_y, shift_vx);
+    trace_printf("shl V%d\n", register_x);
+    break;
+  default:
+    op_unknown(chip8, op->opcode);
+    break;
+  }
+}
+
+void exec_op_9(struct chip8_t *chip8, const struct instruction_t *op) {
+  trace_printf("sne V%d, V%d\n", op->x, op->y);
+  op_9xy0(chip8, op->x, op->y);
+}
+
+void exec_op_a(struct chip8_t *chip8, const struct instruction_t *op) {
+  op_annn(chip8, op->nnn);
+  trace_printf("ld I, %d\n", op->nnn);
+}
+
+static inline void exec_op_b(struct chip8_t *chip8, const struct instruction_t *op, const int jump_vx) {
+  op_bnnn(chip8, op->nnn, jump_vx);
+  trace_printf("jp V0, %d\n", chip8->pc);
+}
+
+void exec_op_c(struct chip8_t *const chip8, const struct instruction_t *op) {
+  const uint8_t random_value=op_cxkk(chip8, op->x, op->kk);
+  trace_printf("rnd V%d, 0x%04X\n", op->x, random_value);
+  (void)random_value;
+}
+
+static inline void exec_op_d(struct chip8_t *const chip8, const struct instruction_t *op, const int wrap) {
+#if CHIP8_TRACE >= 2
+  for(int i=0; i<op->n; ++i) trace_printf("%2x ", chip8->ram[(chip8->i+i) & RAM_MASK]);
+  trace_printf("\n");
+#endif
+  op_dxyn(chip8, op->x, op->y, op->n, wrap);
+  trace_printf("drw %d, %d, %x\n", chip8->v[op->x], chip8->v[op->y], op->n);
+}
+
+void exec_op_e(struct chip8_t *const chip8, const struct instruction_t *op) {
+  const uint8_t register_x=op->x;
+  switch(op->kk) {
+    case 0x9e:
+      op_ex9e(chip8, register_x);
+      trace_printf("skp V%d\n", register_x);
+      break;
+    case 0xa1:
+      op_exa1(chip8, register_x);
+      trace_printf("sknp V%d\n", register_x);
+      break;
+    default:
+      op_unknown(chip8, op->opcode);
+      break;
+  }
+}
+
+static inline void exec_op_f(struct chip8_t *const chip8, const struct instruction_t *op, const int keep_i) {
+  const uint8_t register_x=op->x;
+  switch(op->kk) {
+  case 0x07:
+    op_fx07(chip8, register_x);
+    trace_printf("ld V%d, DT\n", register_x);
+    break;
+  case 0x0a:
+    op_fx0a(chip8, register_x);
+    trace_printf("ld V%d, %d\n", register_x, chip8->v[register_x]);
+    break;
+  case 0x15:
+    op_fx15(chip8, register_x);
+    trace_printf("ld DT, V%d\n", register_x);
+    break;
+  case 0x18:
+    op_fx18(chip8, register_x);
+    trace_printf("ld ST, V%d\n", register_x);
+    break;
+  case 0x1e:
+    op_fx1e(chip8, register_x);
+    trace_printf("add I, V%d\n", register_x);
+    break;
+  case 0x29:
+    op_fx29(chip8, register_x);
+    trace_printf("ld %d, V%d\n", chip8->v[register_x], register_x );
+    break;
+  case 0x30:
+    op_fx30(chip8, register_x);
+    trace_printf("ld HF, V%d\n", register_x);
+    break;
+  case 0x33:
+    op_fx33(chip8, register_x);
+    trace_printf("ld %d, V%d\n", chip8->v[register_x], register_x);
+    break;
+  case 0x55:
+    op_fx55(chip8, register_x, keep_i);
+    trace_printf("ld [%d], V%d\n", chip8->i, register_x);
+    break;
+  case 0x65:
+    op_fx65(chip8, register_x, keep_i);
+    trace_printf("ld V%d, [%d]\n", register_x, chip8->i);
+    break;
+  default:
+    op_unknown(chip8, op->opcode);
+    break;
+  }
+}
+
+// exec_op_8/b/d/f once per quirk profile, with its flags as constants.
+#define X(name, shift_vx, keep_i, jump_vx, wrap) \
+  static void exec_op_8_##name(struct chip8_t *chip8, const struct instruction_t *op) { exec_op_8(chip8, op, shift_vx); } \
+  static void exec_op_b_##name(struct chip8_t *chip8, const struct instruction_t *op) { exec_op_b(chip8, op, jump_vx); } \
+  static void exec_op_d_##name(struct chip8_t *chip8, const struct instruction_t *op) { exec_op_d(chip8, op, wrap); } \
+  static void exec_op_f_##name(struct chip8_t *chip8, const struct instruction_t *op) { exec_op_f(chip8, op, keep_i); }
+QUIRK_PROFILES
+#undef X
+
+#define X(name, shift_vx, keep_i, jump_vx, wrap) { \
+  exec_op_0 ,exec_op_1 ,exec_op_2 ,exec_op_3 \
+  ,exec_op_4 ,exec_op_5 ,exec_op_6 ,exec_op_7 \
+  ,exec_op_8_##name ,exec_op_9 ,exec_op_a ,exec_op_b_##name \
+  ,exec_op_c ,exec_op_d_##name ,exec_op_e ,exec_op_f_##name \
+},
+static const decode_entry routines[QUIRKS_COUNT][16]={ QUIRK_PROFILES };
+#undef X
+
+#define X(name, shift_vx, keep_i, jump_vx, wrap) #name,
+static const char *const quirk_names[QUIRKS_COUNT]={ QUIRK_PROFILES };
+#undef X
+
+// Fused handlers get the slot of the first instruction; the others follow
+// it INSTRUCTION_SIZE slots apart, decoded along with it.
+typedef uint32_t (*fused_entry)(struct chip8_t *chip8, const struct instruction_t *op);
+
+static inline uint32_t fused_annn_dxyn(struct chip8_t *chip8, const struct instruction_t *op, const int wrap) {
+  op_annn(chip8, op[0].nnn);
+  op_dxyn(chip8, op[INSTRUCTION_SIZE].x, op[INSTRUCTION_SIZE].y, op[INSTRUCTION_SIZE].n, wrap);
+  return 2;
+}
+
+static uint32_t fused_6xkk_6xkk(struct chip8_t *chip8, const struct instruction_t *op) {
+  op_6xkk(chip8, op[0].x, op[0].kk);
+  op_6xkk(chip8, op[INSTRUCTION_SIZE].x, op[INSTRUCTION_SIZE].kk);
+  return 2;
+}
+
+// Once the counter hits its limit the skip jumps over the 1nnn.
+static uint32_t fused_7xkk_3xkk_1nnn(struct chip8_t *chip8, const struct instruction_t *op) {
+  op_7xkk(chip8, op[0].x, op[0].kk);
+  op_3xkk(chip8, op[INSTRUCTION_SIZE].x, op[INSTRUCTION_SIZE].kk);
+  if(chip8->v[op[INSTRUCTION_SIZE].x] == op[INSTRUCTION_SIZE].kk) return 2;
+  op_1nnn(chip8, op[2*INSTRUCTION_SIZE].nnn);
+  return 3;
+}
+
+static uint32_t fused_fx15_fx07(struct chip8_t *chip8, const struct instruction_t *op) {
+  op_fx15(chip8, op[0].x);
+  op_fx07(chip8, op[INSTRUCTION_SIZE].x);
+  return 2;
+}
+
+#define X(name, shift_vx, keep_i, jump_vx, wrap) \
+  static uint32_t fused_annn_dxyn_##name(struct chip8_t *chip8, const struct instruction_t *op) { return fused_annn_dxyn(chip8, op, wrap); }
+QUIRK_PROFILES
+#undef X
+
+// In FUSIONS order.
+#define X(name, shift_vx, keep_i, jump_vx, wrap) \
+  { NULL, fused_annn_dxyn_##name, fused_6xkk_6xkk, fused_7xkk_3xkk_1nnn, fused_fx15_fx07 },
+static const fused_entry fused_routines[QUIRKS_COUNT][FUSION_COUNT]={ QUIRK_PROFILES };
+#undef X
+
+#define X(name, length) length,
+static const uint8_t fusion_lengths[FUSION_COUNT]={ 1, FUSIONS };
+#undef X
+
+#define X(name, length) #name,
+static const char *const fusion_names[FUSION_COUNT]={ "none", FUSIONS };
+#undef X
+
+const char *fusion_name(enum fusion_t fusion) {
+  return fusion_names[fusion];
+}
+
+int parse_quirks(const char *const name, enum quirks_t *const quirks) {
+  for(int q=0; q<QUIRKS_COUNT; ++q)
+    if(!strcmp(name, quirk_names[q])) {
+      *quirks=q;
+      return 0;
+    }
+  return -1;
+}
+
+const char *quirks_name(enum quirks_t quirks) {
+  return quirk_names[quirks];
+}
+
+void set_quirks(struct chip8_t *const chip8, enum quirks_t quirks) {
+  chip8->quirks=quirks;
+  for(size_t at=0; at<RAM_SIZE; ++at) chip8->decoded[at].exec=decode_and_exec;
+  memset(chip8->fused, FUSED_undecoded, RAM_SIZE);
+  if(chip8->on_write) chip8->on_write(chip8->on_write_context, 0, RAM_SIZE);
+}
+
+// Every cache slot starts out pointing here: the first execution at a pc
+// decodes the two bytes once, stores the result in the slot and runs it.
+// Later executions go straight to the stored handler.
+void decode(struct instruction_t *const slot, const uint16_t instruction, enum quirks_t quirks) {
+  slot->opcode=instruction;
+  slot->nnn=get_4_bits(instruction, 1, 3);
+  slot->kk=get_4_bits(instruction, 1, 2);
+  slot->n=get_4_bits(instruction, 1, 1);
+  slot->y=get_4_bits(instruction, 2, 1);
+  slot->x=get_4_bits(instruction, 3, 1);
+  slot->exec=routines[quirks][get_4_bits(instruction, 4, 1)];
+}
+
+uint16_t fetch(const struct chip8_t *const chip8, const uint16_t addr) {
+  return (chip8->ram[addr & RAM_MASK]<<8)|chip8->ram[(addr+1) & RAM_MASK];
+}
+
+// Sequences never wrap around the end of ram, so their slots are
+// contiguous.
+static enum fusion_t fusion_at(const struct chip8_t *const chip8, uint16_t addr) {
+  if(addr+2*INSTRUCTION_SIZE > RAM_MASK+1) return FUSED_none;
+  const uint16_t first=fetch(chip8, addr), second=fetch(chip8, addr+INSTRUCTION_SIZE);
+  if((first & 0xF000) == 0xA000 && (second & 0xF000) == 0xD000) return FUSED_annn_dxyn;
+  if((first & 0xF000) == 0x6000 && (second & 0xF000) == 0x6000) return FUSED_6xkk_6xkk;
+  if((first & 0xF0FF) == 0xF015 && (second & 0xF0FF) == 0xF007) return FUSED_fx15_fx07;
+  if((first & 0xF000) == 0x7000 && (second & 0xF000) == 0x3000 && addr+3*INSTRUCTION_SIZE <= RAM_MASK+1
+     && (fetch(chip8, addr+2*INSTRUCTION_SIZE) & 0xF000) == 0x1000)
+    return FUSED_7xkk_3xkk_1nnn;
+  return FUSED_none;
+}
+
+// Decodes the instruction at addr and looks for a sequence starting there,
+// decoding the rest of it too for its fused handler.
+static void decode_at(struct chip8_t *const chip8, uint16_t addr) {
+  struct instruction_t *const slot=chip8->decoded+addr;
+  decode(slot, fetch(chip8, addr), chip8->quirks);
+  chip8->fused[addr]=CHIP8_TRACE || CHIP8_PROFILE ? FUSED_none : fusion_at(chip8, addr);
+  for(int k=1; k<fusion_lengths[chip8->fused[addr]]; ++k) {
+    struct instruction_t *const next=slot+k*INSTRUCTION_SIZE;
+    if(next->exec == decode_and_exec) decode(next, fetch(chip8, addr+k*INSTRUCTION_SIZE), chip8->quirks);
+  }
+}
+
+void decode_and_exec(struct chip8_t *chip8, const struct instruction_t *op) {
+  const uint16_t addr=op-chip8->decoded;
+  decode_at(chip8, addr);
+  chip8->decoded[addr].exec(chip8, chip8->decoded+addr);
+}
+
+void invalidate_decoded(struct chip8_t *const chip8, uint16_t addr, uint16_t size) {
+  addr&=RAM_MASK;
+  // Stores wrap at the end of ram; hooks get each contiguous piece.
+  if(addr+size > RAM_MASK+1) {
+    const uint16_t head=RAM_MASK+1-addr;
+    invalidate_decoded(chip8, addr, head);
+    invalidate_decoded(chip8, 0, size-head);
+    return;
+  }
+  // The instruction starting one byte earlier also reads the first byte,
+  // and a fused sequence can start up to MAX_FUSED-1 instructions before
+  // that; step() looks for it again.
+  // Locals, since the byte stores may alias *chip8 and force a reload.
+  struct instruction_t *const decoded=chip8->decoded;
+  uint8_t *const fused=chip8->fused;
+  for(int at=addr-1-(MAX_FUSED-1)*INSTRUCTION_SIZE; at < addr+size; ++at) {
+    if(at >= addr-1) decoded[at & RAM_MASK].exec=decode_and_exec;
+    fused[at & RAM_MASK]=FUSED_undecoded;
+  }
+  if(chip8->on_write) chip8->on_write(chip8->on_write_context, addr, size);
+}
+
+uint64_t frame_buffer_hash(const struct chip8_t *const chip8) {
+  // FNV-1a over the packed rows; the low resolution ones come first.
+  const uint8_t *const bytes=(const uint8_t *)chip8->frame_buffer;
+  const size_t size=chip8->hires ? FRAME_BUFFER_SIZE : SCREEN_HEIGHT*sizeof(uint64_t);
+  uint64_t hash=0xcbf29ce484222325;
+  for(size_t at=0; at<size; ++at) {
+    hash^=bytes[at];
+    hash*=0x100000001b3;
+  }
+  return hash;
+}
+
+int same_state(const struct chip8_t *const a, const struct chip8_t *const b) {
+  return !memcmp(a->v, b->v, sizeof(a->v)) && a->i == b->i && a->pc == b->pc
+    && a->sp == b->sp && a->dt == b->dt && a->st == b->st && a->hires == b->hires
+    && !memcmp(a->stack, b->stack, sizeof(a->stack))
+    && !memcmp(a->rng, b->rng, sizeof(a->rng))
+    && !memcmp(a->ram, b->ram, RAM_SIZE)
+    && !memcmp(a->frame_buffer, b->frame_buffer, FRAME_BUFFER_SIZE);
+}
+
+void tick_timers(struct chip8_t *const chip8) {
+  if(chip8->dt) chip8->dt--;
+  if(chip8->st) chip8->st--;
+}
+
+#if !(CHIP8_TRACE || CHIP8_PROFILE)
+// Instructions that read anything but write nothing except V, I, pc and
+// dt. Fx18 is left out so the beeper never misses an st change.
+static int idle_safe(enum kind_t kind) {
+  switch(kind) {
+  case KIND_00e0: case KIND_00ee: case KIND_00cn: case KIND_00fb: case KIND_00fc:
+  case KIND_00fe: case KIND_00ff: case KIND_2nnn: case KIND_cxkk: case KIND_dxyn:
+  case KIND_fx0a: case KIND_fx18: case KIND_fx33: case KIND_fx55:
+    return 0;
+  default:
+    return 1;
+  }
+}
+#endif
+
+uint32_t idle_loop(struct chip8_t *const chip8, uint64_t cycles, uint64_t *const ran) {
+#if CHIP8_TRACE || CHIP8_PROFILE
+  // Skipped passes would be missing from the records.
+  (void)chip8;
+  (void)cycles;
+  (void)ran;
+  return 0;
+#else
+  if(cycles < IDLE_MIN_SKIP) return 0;
+  const uint16_t start=chip8->pc;
+  // Cheap filter first: following jumps and never taking skips has to
+  // lead back to pc through safe instructions only.
+  uint16_t at=start;
+  for(int length=0;; ++length) {
+    if(length == IDLE_LOOP_MAX) return 0;
+    const uint16_t opcode=fetch(chip8, at);
+    const enum kind_t kind=kind_of(opcode);
+    if(!idle_safe(kind) || kind == KIND_bnnn) return 0;
+    if(kind == KIND_0nnn || kind == KIND_1nnn) at=opcode & 0xFFF;
+    // 00FD and the unassigned 8xyN/ExNN stay where they are.
+    else if(kind != KIND_00fd && (kind != KIND_unknown || (opcode >> 12) == 0xf)) at+=INSTRUCTION_SIZE;
+    if(at == start) break;
+  }
+  // The first pass may load what later ones only reload (Fx07 copies dt
+  // once); the second has to leave V, I and dt as it found them. Then so
+  // will every pass after it, since what they read cannot change before
+  // the tick or the next keypad change.
+  uint8_t v[16];
+  uint16_t i=0;
+  uint8_t dt=0;
+  uint32_t length=0;
+  for(int pass=0; pass<2; ++pass) {
+    memcpy(v, chip8->v, sizeof(v));
+    i=chip8->i;
+    dt=chip8->dt;
+    length=0;
+    do {
+      if(*ran == cycles || length == IDLE_LOOP_MAX || !idle_safe(kind_of(fetch(chip8, chip8->pc)))) return 0;
+      cycle(chip8);
+      ++*ran;
+      ++length;
+    } while(chip8->pc != start);
+  }
+  return !memcmp(v, chip8->v, sizeof(v)) && i == chip8->i && dt == chip8->dt ? length : 0;
+#endif
+}
+
+// cycle() proper, inlined wherever step() runs so an unfused instruction
+// costs no more calls than cycle() does.
+static inline void execute(struct chip8_t *const chip8) {
+  const struct instruction_t *const op=chip8->decoded+(chip8->pc & RAM_MASK);
+  trace_printf("0x%04X 0x%04X => ", chip8->pc, fetch(chip8, chip8->pc));
+#if CHIP8_TRACE
+  const uint16_t pc=chip8->pc, i=chip8->i;
+  uint8_t before[16];
+  memcpy(before, chip8->v, 16);
+#endif
+#if CHIP8_PROFILE
+  const uint16_t profile_pc=chip8->pc;
+  const uint16_t opcode=fetch(chip8, profile_pc);
+  const uint64_t start=profile_clock();
+#endif
+  op->exec(chip8, op);
+#if CHIP8_PROFILE
+  profile_count(profile_pc, opcode, profile_clock()-start);
+#endif
+#if CHIP8_TRACE
+  trace_append(pc, op->opcode, i, before, chip8->v);
+#endif
+}
+
+void cycle(struct chip8_t *const chip8) {
+  execute(chip8);
+}
+
+static inline uint32_t fused_or_single(struct chip8_t *const chip8, uint64_t budget) {
+  const uint16_t pc=chip8->pc & RAM_MASK;
+  // Decoding here rather than in cycle() lets code that runs only once,
+  // like most setup code, fuse as well.
+  if(chip8->fused[pc] == FUSED_undecoded) decode_at(chip8, pc);
+  const enum fusion_t fused=chip8->fused[pc];
+  if(fused != FUSED_none && fusion_lengths[fused] <= budget) return fused_routines[chip8->quirks][fused](chip8, chip8->decoded+pc);
+  execute(chip8);
+  return 1;
+}
+
+uint32_t step(struct chip8_t *const chip8, uint64_t budget) {
+  return fused_or_single(chip8, budget);
+}
+
+void run_cycles(struct chip8_t *const chip8, uint64_t cycles) {
+  while(cycles) cycles-=fused_or_single(chip8, cycles);
+}
+
+uint64_t idle_skip(struct chip8_t *const chip8, uint64_t budget, struct idle_memo_t *const memo) {
+  // idle_loop() would not look, so there is nothing to remember either.
+  if(budget < IDLE_MIN_SKIP) return 0;
+  const uint16_t pc=chip8->pc;
+  uint16_t *const slot=memo->rejected+(pc >> 1) % IDLE_MEMO_SLOTS;
+  if(*slot == (uint16_t)(pc+1)) return 0;
+  uint64_t ran=0;
+  const uint32_t length=idle_loop(chip8, budget, &ran);
+  if(length) return budget-(budget-ran) % length;
+  *slot=pc+1;
+  return ran;
+}
+
+uint64_t frame_step(struct chip8_t *const chip8, uint64_t budget, struct idle_memo_t *const memo) {
+  const uint16_t pc=chip8->pc;
+  if(memo->probe) {
+    memo->probe=0;
+    const uint64_t skipped=idle_skip(chip8, budget, memo);
+    if(skipped) return skipped;
+  }
+  const uint32_t ran=fused_or_single(chip8, budget);
+  memo->probe=chip8->pc <= pc;
+  return ran;
+}
+
+void run_frame(struct chip8_t *const chip8, uint32_t instructions) {
+  struct idle_memo_t memo={ .probe=1 };
+  while(instructions && !waiting_for_key(chip8)) instructions-=frame_step(chip8, instructions, &memo);
+  tick_timers(chip8);
+}
@@ -0,0 +1,236 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define ORG 0x200
+#define MAX_ROM_SIZE ((1<<12)-ORG)
+
+#define SCREEN_WIDTH 64
+#define SCREEN_HEIGHT 32
+// SUPER-CHIP high resolution, entered with 00FF and left with 00FE.
+#define HIRES_WIDTH 128
+#define HIRES_HEIGHT 64
+// Fx29 digits are 5 bytes from address 0, Fx30 ones 10 bytes from here.
+#define BIG_FONT 0x50
+
+#define PIXELS_PER_ROW 64
+#define PIXELS_PER_COL 32
+#define INSTRUCTION_SIZE 2
+#define RAM_MASK 0xFFF
+#define RAM_SIZE (RAM_MASK+1)
+
+// dt and st count down at 60 Hz; the CPU runs a fixed number of
+// instructions per timer tick so game speed does not depend on the host.
+#define TIMER_HZ 60
+#define DEFAULT_IPF 11
+#define STACK_MASK 0xF
+// Cxkk draws from a per-instance generator, so a run is a function of the
+// ROM, the seed and the keypad input alone.
+#define DEFAULT_SEED 0xC8
+
+// Behaviour that differs between CHIP-8 implementations, one row per
+// profile. Each profile gets its own copy of the handlers involved, with
+// these folded in as constants, so nothing is checked per instruction.
+//   shift_vx  8xy6/8xyE shift Vx in place instead of setting Vx to Vy shifted
+//   keep_i    Fx55/Fx65 leave I alone instead of moving it past the last register
+//   jump_vx   Bxnn jumps to xnn+Vx instead of nnn+V0
+//   wrap      sprites wrap around the screen edges instead of being clipped
+// modern is what this emulator has always done and what boot() picks.
+#define QUIRK_PROFILES \
+  X(modern, 1, 1, 0, 0) \
+  X(vip,    0, 0, 0, 0) \
+  X(schip,  1, 1, 1, 0) \
+  X(xochip, 0, 0, 0, 1)
+
+#define X(name, shift_vx, keep_i, jump_vx, wrap) QUIRKS_##name,
+enum quirks_t { QUIRK_PROFILES QUIRKS_COUNT };
+#undef X
+
+// Instruction sequences the interpreter dispatches as one handler when they
+// are decoded back to back, with the number of instructions in each.
+//   annn_dxyn       point I at a sprite and draw it
+//   6xkk_6xkk       load two registers, typically sprite coordinates
+//   7xkk_3xkk_1nnn  counting loop: step, compare, jump back
+//   fx15_fx07       set the delay timer and read it back
+#define FUSIONS \
+  X(annn_dxyn, 2) \
+  X(6xkk_6xkk, 2) \
+  X(7xkk_3xkk_1nnn, 3) \
+  X(fx15_fx07, 2)
+#define MAX_FUSED 3
+
+// FUSED_undecoded marks addresses not looked at since their last change.
+#define X(name, length) FUSED_##name,
+enum fusion_t { FUSED_none, FUSIONS FUSION_COUNT, FUSED_undecoded=0xFF };
+#undef X
+
+struct chip8_t;
+struct instruction_t;
+
+typedef void (*decode_entry)(struct chip8_t *chip8, const struct instruction_t *op);
+typedef void (*write_hook)(void *context, uint16_t addr, uint16_t size);
+
+// One pre-decoded slot per ram address, filled on first execution.
+struct instruction_t {
+  decode_entry exec;
+  uint16_t opcode, nnn;
+  uint8_t x, y, n, kk;
+};
+
+// The bulky part of a machine, kept out of struct chip8_t so the registers
+// of many instances pack densely instead of sharing cache lines and TLB
+// entries with their ram.
+struct chip8_memory_t {
+  uint8_t ram[RAM_SIZE];
+  // enum fusion_t of the sequence starting at each address, found when
+  // its first instruction is decoded; see step().
+  uint8_t fused[RAM_SIZE];
+  // One bit per pixel, one word per row in each of the left and right
+  // halves; x=0 is the most significant bit of the left word. Low
+  // resolution only uses the top SCREEN_HEIGHT rows of the left half.
+  uint64_t frame_buffer[2][HIRES_HEIGHT];
+  struct instruction_t decoded[RAM_SIZE];
+};
+#define FRAME_BUFFER_SIZE sizeof(((struct chip8_memory_t *)0)->frame_buffer)
+
+// The first cache line is everything an instruction usually touches; the
+// second holds what calls, Cxkk and stores do.
+struct chip8_t {
+  _Alignas(64) uint8_t v[16];
+  uint16_t i, pc;
+  uint8_t sp, dt, st;
+  uint8_t waiting; // set by Fx0A while no key is down
+  uint16_t keys; // bit k set while key k is down
+  uint8_t quirks; // enum quirks_t, see set_quirks()
+  uint8_t hires;
+  uint8_t draw; // set by anything that changes the display, cleared by whoever presents the frame
+  // Into the struct chip8_memory_t handed out by arena_attach().
+  uint8_t *ram;
+  uint8_t *fused;
+  uint64_t (*frame_buffer)[HIRES_HEIGHT];
+  struct instruction_t *decoded;
+  _Alignas(64) uint16_t stack[16];
+  uint32_t rng[4]; // xoshiro128** state, see seed_random()
+  // Optional listener for ram stores, e.g. to drop translated code.
+  write_hook on_write;
+  void *on_write_context;
+};
+_Static_assert(sizeof(struct chip8_t) == 128, "registers in one cache line, the rest in the next");
+
+// Memory for up to `count` machines out of one allocation, a page-aligned
+// slot each so that ram starts on a page of its own.
+struct chip8_arena_t {
+  uint8_t *slots;
+  size_t count, used;
+};
+
+// Returns -1 if out of memory.
+int arena_init(struct chip8_arena_t *const arena, size_t count);
+void arena_free(struct chip8_arena_t *const arena);
+// Gives chip8 the next free slot, to boot into. Returns -1 once all
+// `count` are taken.
+int arena_attach(struct chip8_arena_t *const arena, struct chip8_t *const chip8);
+// Same for memory from anywhere else.
+void attach_memory(struct chip8_t *const chip8, struct chip8_memory_t *const memory);
+// Makes `to`, attached to its own slot, a copy of `from`.
+void copy_state(struct chip8_t *const to, const struct chip8_t *const from);
+
+// Fx0A found no key down, so running on changes nothing until one is.
+static inline int waiting_for_key(const struct chip8_t *const chip8) {
+  return chip8->waiting && !chip8->keys;
+}
+
+#define PIXEL_MASK(pos_x) ((uint64_t)1 << (63-((pos_x) & 63)))
+
+static inline uint8_t get_pixel(const uint64_t rows[2][HIRES_HEIGHT], uint16_t pos_x, uint16_t pos_y) {
+  return (rows[pos_x >> 6][pos_y] & PIXEL_MASK(pos_x)) != 0;
+}
+
+static inline int screen_width(const struct chip8_t *const chip8) {
+  return chip8->hires ? HIRES_WIDTH : SCREEN_WIDTH;
+}
+
+static inline int screen_height(const struct chip8_t *const chip8) {
+  return chip8->hires ? HIRES_HEIGHT : SCREEN_HEIGHT;
+}
+
+void set_pixel(uint64_t rows[2][HIRES_HEIGHT], uint16_t pos_x, uint16_t pos_y, uint8_t bit);
+void invert_pixel(uint64_t rows[2][HIRES_HEIGHT], uint16_t pos_x, uint16_t pos_y);
+// Returns the file size, or -1 if it cannot be read or is larger than
+// `capacity`.
+ssize_t read_file(const char *const file_name, uint8_t *const buffer, size_t capacity);
+// Returns the ROM size, or -1 leaving chip8 alone if it cannot be read or
+// does not fit. Also seeds the generator with DEFAULT_SEED.
+ssize_t boot(struct chip8_t *const chip8, const char *const rom_name);
+// Same as boot() for a ROM already in memory; anything past the end of ram
+// is dropped. Both start out with the modern quirks.
+void boot_rom(struct chip8_t *const chip8, const uint8_t *const rom, size_t size);
+void seed_random(struct chip8_t *const chip8, uint64_t seed);
+// Switches to the handlers of another profile; everything decoded so far
+// is dropped, translated code included.
+void set_quirks(struct chip8_t *const chip8, enum quirks_t quirks);
+// Returns -1 for a name that is not in QUIRK_PROFILES.
+int parse_quirks(const char *const name, enum quirks_t *const quirks);
+const char *quirks_name(enum quirks_t quirks);
+void decode(struct instruction_t *const slot, const uint16_t instruction, enum quirks_t quirks);
+uint16_t fetch(const struct chip8_t *const chip8, const uint16_t addr);
+void decode_and_exec(struct chip8_t *chip8, const struct instruction_t *op);
+// Must be called for every store into ram so stale decodes are dropped.
+void invalidate_decoded(struct chip8_t *const chip8, uint16_t addr, uint16_t size);
+void cycle(struct chip8_t *const chip8);
+// Runs the fused sequence at pc if there is one of at most `budget`
+// instructions, else one instruction like cycle(). Returns how many
+// instructions ran: a sequence that branches out early runs fewer than its
+// length. Tracing and profiling builds never fuse, so their records stay
+// complete.
+uint32_t step(struct chip8_t *const chip8, uint64_t budget);
+// Exactly `cycles` instructions through step(), without a call per step.
+void run_cycles(struct chip8_t *const chip8, uint64_t cycles);
+const char *fusion_name(enum fusion_t fusion);
+void tick_timers(struct chip8_t *const chip8);
+// Registers, stack, timers, generator, ram and display: what lockstep
+// runs compare.
+int same_state(const struct chip8_t *const a, const struct chip8_t *const b);
+// Covers the part of the display the current resolution shows.
+uint64_t frame_buffer_hash(const struct chip8_t *const chip8);
+// A pass of an idle loop is at most this many instructions, and with
+// fewer than IDLE_MIN_SKIP to go, finding one would cost about what
+// skipping it saves.
+#define IDLE_LOOP_MAX 8
+#define IDLE_MIN_SKIP (4*IDLE_LOOP_MAX)
+// Most games wait for the delay timer or a key by spinning on Fx07/3xkk/
+// 1nnn or Exkk/1nnn, or park on a jump to itself. If pc is in such a loop,
+// runs it (at most `cycles` instructions, added to *ran) until a pass
+// provably repeats the one before, and returns the pass length: from there
+// any whole number of passes leaves the machine exactly as it is, as long
+// as no timer tick or keypad change falls inside them. Returns 0 otherwise,
+// having run *ran instructions like cycle(), and always when `cycles` is
+// under IDLE_MIN_SKIP.
+uint32_t idle_loop(struct chip8_t *const chip8, uint64_t cycles, uint64_t *const ran);
+// The pcs found not to be in an idle loop since the memo was zeroed, which
+// its owner does whenever dt or the keys may have changed: once a frame.
+// Slots hold whole pcs, so a pc evicting another from its slot only costs
+// that one a second probe, never hides its loop.
+#define IDLE_MEMO_SLOTS 16
+struct idle_memo_t {
+  uint16_t rejected[IDLE_MEMO_SLOTS]; // pc+1, 0 for a free slot
+  int probe; // for frame_step(): pc is worth probing
+};
+// Probes idle_loop() at pc unless the memo already rejected it. Returns
+// how many instructions that accounts for: 0 if nothing ran, else what
+// ran plus the whole passes of an idle loop that fit in `budget`.
+uint64_t idle_skip(struct chip8_t *const chip8, uint64_t budget, struct idle_memo_t *const memo);
+// Runs step(), or skips to within one pass of the end of `budget` if pc is
+// in an idle loop. Returns how many instructions that accounts for. Only
+// probes where the frame starts and where a jump lands at or before the
+// jumping instruction, the only ways into a loop.
+uint64_t frame_step(struct chip8_t *const chip8, uint64_t budget, struct idle_memo_t *const memo);
+// One 60 Hz frame: `instructions` cycles, then a timer tick. A frame that
+// reaches Fx0A with no key down skips its remaining cycles, since they
+// would only wait again, and so does one that settles into an idle loop.
+void run_frame(struct chip8_t *const chip8, uint32_t instructions);
+
+#endif
@@ -0,0 +1,458 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "chip8.h"
+#include "dynarec.h"
+#include "profile.h"
+
+// Translated blocks would bypass the tracing and profiling hooks in cycle().
+#if defined(__x86_64__) && !(CHIP8_TRACE || CHIP8_PROFILE)
+
+#include <sys/mman.h>
+
+// Register plan inside a block:
+//   rbx      struct chip8_t *
+//   r12d     I
+//   al, cl   scratch
+//   rdx, rsi, rdi, rbp, r8-r11, r13-r15
+//            the V registers used most in the block, loaded on entry and
+//            written back on exit and around interpreter calls; the rest
+//            are accessed in place through [rbx+x]
+// pc is a translation-time constant and is only stored on exit.
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+static const uint8_t pinnable[]={ RDX, RSI, RDI, RBP, R8, R9, R10, R11, R13, R14, R15 };
+
+#define OFFSET_V offsetof(struct chip8_t, v)
+#define OFFSET_I offsetof(struct chip8_t, i)
+#define OFFSET_PC offsetof(struct chip8_t, pc)
+#define OFFSET_DT offsetof(struct chip8_t, dt)
+#define OFFSET_ST offsetof(struct chip8_t, st)
+
+#define REX(w, r, b) (0x40|((w)<<3)|(((r)>>3)<<2)|((b)>>3))
+#define MODRM(mod, reg, rm) (((mod)<<6)|(((reg)&7)<<3)|((rm)&7))
+
+#define EMIT(t, ...) emit_bytes(t, (const uint8_t[]){ __VA_ARGS__ }, sizeof((const uint8_t[]){ __VA_ARGS__ }))
+
+struct translation_t {
+  struct dynarec_t *dynarec;
+  uint8_t *at, *limit;
+  uint8_t *body; // first instruction, after the state is loaded
+  uint16_t start, length;
+  int8_t pinned[16]; // host register per V register, -1 when in memory
+};
+
+static void emit_bytes(struct translation_t *const t, const uint8_t *bytes, size_t size) {
+  if(t->at+size > t->limit) {
+    t->at=t->limit+1; // overflow, checked once the block is done
+    return;
+  }
+  memcpy(t->at, bytes, size);
+  t->at+=size;
+}
+
+static void emit_u16(struct translation_t *const t, uint16_t value) {
+  EMIT(t, value & 0xFF, value >> 8);
+}
+
+static void emit_u32(struct translation_t *const t, uint32_t value) {
+  EMIT(t, value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24);
+}
+
+static void emit_u64(struct translation_t *const t, uint64_t value) {
+  emit_u32(t, value);
+  emit_u32(t, value >> 32);
+}
+
+// scratch <- Vx
+static void load_v(struct translation_t *const t, uint8_t scratch, uint8_t x) {
+  if(t->pinned[x] >= 0) EMIT(t, REX(0, t->pinned[x], scratch), 0x88, MODRM(3, t->pinned[x], scratch));
+  else EMIT(t, REX(0, scratch, RBX), 0x8A, MODRM(1, scratch, RBX), OFFSET_V+x);
+}
+
+// Vx <- scratch
+static void store_v(struct translation_t *const t, uint8_t x, uint8_t scratch) {
+  if(t->pinned[x] >= 0) EMIT(t, REX(0, scratch, t->pinned[x]), 0x88, MODRM(3, scratch, t->pinned[x]));
+  else EMIT(t, REX(0, scratch, RBX), 0x88, MODRM(1, scratch, RBX), OFFSET_V+x);
+}
+
+static void load_state(struct translation_t *const t) {
+  EMIT(t, 0x44, 0x0F, 0xB7, MODRM(1, R12, RBX), OFFSET_I); // movzx r12d, word [rbx+i]
+  for(uint8_t x=0; x<16; ++x) {
+    const int8_t reg=t->pinned[x];
+    if(reg >= 0) EMIT(t, REX(0, reg, RBX), 0x0F, 0xB6, MODRM(1, reg, RBX), OFFSET_V+x);
+  }
+}
+
+static void store_state(struct translation_t *const t, uint16_t pc) {
+  EMIT(t, 0x66, 0x44, 0x89, MODRM(1, R12, RBX), OFFSET_I); // mov [rbx+i], r12w
+  for(uint8_t x=0; x<16; ++x) {
+    const int8_t reg=t->pinned[x];
+    if(reg >= 0) EMIT(t, REX(0, reg, RBX), 0x88, MODRM(1, reg, RBX), OFFSET_V+x);
+  }
+  EMIT(t, 0x66, 0xC7, MODRM(1, 0, RBX), OFFSET_PC); // mov word [rbx+pc], imm16
+  emit_u16(t, pc);
+}
+
+static void emit_prologue(struct translation_t *const t) {
+  EMIT(t, 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57); // push rbx, rbp, r12-r15
+  EMIT(t, 0x48, 0x83, 0xEC, 0x08); // sub rsp, 8 (keeps calls 16-byte aligned)
+  EMIT(t, 0x48, 0x89, 0xFB); // mov rbx, rdi
+  EMIT(t, 0x48, 0x89, 0x34, 0x24); // mov [rsp], rsi (cycle budget)
+  load_state(t);
+}
+
+// Every block ends in exactly one of the exits below, after all of its
+// instructions ran, so the budget is charged once on the way out.
+static void emit_epilogue(struct translation_t *const t) {
+  EMIT(t, 0x48, 0x83, 0x2C, 0x24, t->length); // sub qword [rsp], length
+  EMIT(t, 0x48, 0x8B, 0x04, 0x24); // mov rax, [rsp]
+  EMIT(t, 0x48, 0x83, 0xC4, 0x08); // add rsp, 8
+  EMIT(t, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3); // pop r15-r12, rbp, rbx; ret
+}
+
+static void emit_exit(struct translation_t *const t, uint16_t pc) {
+  store_state(t, pc);
+  emit_epilogue(t);
+}
+
+// Flags from a preceding cmp select between the two successors; mov does not
+// touch them, so the state can be written back in between.
+static void emit_conditional_exit(struct translation_t *const t, uint8_t cmov, uint16_t taken, uint16_t not_taken) {
+  store_state(t, not_taken);
+  EMIT(t, 0xB8); emit_u32(t, not_taken); // mov eax, not_taken
+  EMIT(t, 0xB9); emit_u32(t, taken); // mov ecx, taken
+  EMIT(t, 0x0F, cmov, MODRM(3, RAX, RCX)); // cmovcc eax, ecx
+  EMIT(t, 0x66, 0x89, MODRM(1, RAX, RBX), OFFSET_PC); // mov [rbx+pc], ax
+  emit_epilogue(t);
+}
+
+static int emit_helper(struct translation_t *const t, uint16_t pc, const struct instruction_t *const op) {
+  struct dynarec_t *const dynarec=t->dynarec;
+  if(dynarec->ops_used == DYNAREC_MAX_OPS) return -1;
+  struct instruction_t *const copy=dynarec->ops+dynarec->ops_used++;
+  *copy=*op;
+  store_state(t, pc);
+  EMIT(t, 0x48, 0x89, 0xDF); // mov rdi, rbx
+  EMIT(t, 0x48, 0xBE); emit_u64(t, (uintptr_t)copy); // mov rsi, imm64
+  EMIT(t, 0x48, 0xB8); emit_u64(t, (uintptr_t)op->exec); // mov rax, imm64
+  EMIT(t, 0xFF, 0xD0); // call rax
+  load_state(t);
+  return 0;
+}
+
+enum { NATIVE, NATIVE_END, HELPER, HELPER_END };
+
+// The native shifts are the in-place ones; other profiles take the helper.
+#define X(name, shift_vx, keep_i, jump_vx, wrap) shift_vx,
+static const uint8_t shifts_vx[QUIRKS_COUNT]={ QUIRK_PROFILES };
+#undef X
+
+static int classify(const struct instruction_t *const op, enum quirks_t quirks) {
+  switch(op->opcode >> 12) {
+  case 0x0:
+    // Clearing, scrolling and switching resolution all fall through to
+    // the next instruction.
+    if(op->nnn == 0x0e0 || (op->nnn & 0xFF0) == 0x0c0 || op->nnn == 0x0fb || op->nnn == 0x0fc || op->nnn == 0x0fe || op->nnn == 0x0ff) return HELPER;
+    return HELPER_END;
+  case 0x1: case 0x3: case 0x4: case 0x5: case 0x9: return NATIVE_END;
+  case 0x2: case 0xb: case 0xe: return HELPER_END;
+  case 0x6: case 0x7: case 0xa: return NATIVE;
+  case 0x8:
+    switch(op->n) {
+    case 0x0: case 0x1: case 0x2: case 0x3: case 0x4:
+    case 0x5: case 0x7: return NATIVE;
+    case 0x6: case 0xe: return shifts_vx[quirks] ? NATIVE : HELPER;
+    default: return HELPER_END; // leaves pc alone
+    }
+  case 0xc: case 0xd: return HELPER;
+  case 0xf:
+    switch(op->kk) {
+    case 0x07: case 0x15: case 0x18: case 0x1e: return NATIVE;
+    case 0x0a: case 0x33: case 0x55: return HELPER_END; // may wait or invalidate
+    default: return HELPER;
+    }
+  }
+  return HELPER_END;
+}
+
+static void emit_native(struct translation_t *const t, uint16_t pc, const struct instruction_t *const op) {
+  const uint8_t x=op->x, y=op->y;
+  switch(op->opcode >> 12) {
+  case 0x1:
+    if(op->nnn == t->start) {
+      // Loops back onto itself: keep going while the budget covers another
+      // full pass, without leaving the block.
+      EMIT(t, 0x48, 0x83, 0x2C, 0x24, t->length); // sub qword [rsp], length
+      EMIT(t, 0x48, 0x83, 0x3C, 0x24, t->length); // cmp qword [rsp], length
+      EMIT(t, 0x0F, 0x83); // jae body
+      emit_u32(t, t->body-(t->at+4));
+      EMIT(t, 0x48, 0x83, 0x04, 0x24, t->length); // add qword [rsp], length, charged again on exit
+    }
+    emit_exit(t, op->nnn);
+    break;
+  case 0x3:
+  case 0x4:
+    load_v(t, RAX, x);
+    EMIT(t, 0x3C, op->kk); // cmp al, kk
+    emit_conditional_exit(t, (op->opcode >> 12) == 0x3 ? 0x44 : 0x45, pc+4, pc+2);
+    break;
+  case 0x5:
+  case 0x9:
+    load_v(t, RAX, x);
+    load_v(t, RCX, y);
+    EMIT(t, 0x38, MODRM(3, RCX, RAX)); // cmp al, cl
+    emit_conditional_exit(t, (op->opcode >> 12) == 0x5 ? 0x44 : 0x45, pc+4, pc+2);
+    break;
+  case 0x6:
+    EMIT(t, 0xB0, op->kk); // mov al, kk
+    store_v(t, x, RAX);
+    break;
+  case 0x7:
+    load_v(t, RAX, x);
+    EMIT(t, 0x04, op->kk); // add al, kk
+    store_v(t, x, RAX);
+    break;
+  case 0xa:
+    EMIT(t, 0x41, 0xBC); emit_u32(t, op->nnn); // mov r12d, nnn
+    break;
+  case 0x8: {
+    // Each step mirrors a statement of exec_op_8, in order, so aliasing
+    // between x, y and F resolves the same way.
+    static const uint8_t logic[4]={ 0x88, 0x08, 0x20, 0x30 }; // mov, or, and, xor
+    switch(op->n) {
+    case 0x0: case 0x1: case 0x2: case 0x3:
+      load_v(t, RAX, x);
+      load_v(t, RCX, y);
+      EMIT(t, logic[op->n], MODRM(3, RCX, RAX));
+      store_v(t, x, RAX);
+      break;
+    case 0x4:
+      load_v(t, RAX, x);
+      load_v(t, RCX, y);
+      EMIT(t, 0x00, MODRM(3, RCX, RAX)); // add al, cl
+      EMIT(t, 0x0F, 0x92, MODRM(3, 0, RCX)); // setc cl
+      store_v(t, 0xF, RCX);
+      store_v(t, x, RAX);
+      break;
+    case 0x5:
+    case 0x7: {
+      const uint8_t minuend=op->n == 0x5 ? x : y, subtrahend=op->n == 0x5 ? y : x;
+      load_v(t, RAX, minuend);
+      load_v(t, RCX, subtrahend);
+      EMIT(t, 0x38, MODRM(3, RCX, RAX)); // cmp al, cl
+      EMIT(t, 0x0F, 0x97, MODRM(3, 0, RCX)); // seta cl
+      store_v(t, 0xF, RCX);
+      load_v(t, RAX, minuend);
+      load_v(t, RCX, subtrahend);
+      EMIT(t, 0x28, MODRM(3, RCX, RAX)); // sub al, cl
+      store_v(t, x, RAX);
+      break;
+    }
+    case 0x6:
+    case 0xe:
+      load_v(t, RCX, x);
+      if(op->n == 0x6) EMIT(t, 0x80, MODRM(3, 4, RCX), 0x01); // and cl, 1
+      else EMIT(t, 0xC0, MODRM(3, 5, RCX), 7); // shr cl, 7
+      store_v(t, 0xF, RCX);
+      load_v(t, RAX, x);
+      EMIT(t, 0xD0, MODRM(3, op->n == 0x6 ? 5 : 4, RAX)); // shr/shl al, 1
+      store_v(t, x, RAX);
+      break;
+    }
+    break;
+  }
+  case 0xf:
+    switch(op->kk) {
+    case 0x07:
+      EMIT(t, 0x8A, MODRM(1, RAX, RBX), OFFSET_DT); // mov al, [rbx+dt]
+      store_v(t, x, RAX);
+      break;
+    case 0x15:
+    case 0x18:
+      load_v(t, RAX, x);
+      EMIT(t, 0x88, MODRM(1, RAX, RBX), op->kk == 0x15 ? OFFSET_DT : OFFSET_ST);
+      break;
+    case 0x1e:
+      load_v(t, RAX, x);
+      EMIT(t, 0x0F, 0xB6, MODRM(3, RAX, RAX)); // movzx eax, al
+      EMIT(t, 0x66, 0x41, 0x01, MODRM(3, RAX, R12)); // add r12w, ax
+      break;
+    }
+    break;
+  }
+}
+
+static void count_uses(const struct instruction_t *const op, uint32_t uses[16]) {
+  switch(op->opcode >> 12) {
+  case 0x3: case 0x4: case 0x6: case 0x7:
+    uses[op->x]++;
+    break;
+  case 0x5: case 0x9:
+    uses[op->x]++;
+    uses[op->y]++;
+    break;
+  case 0x8:
+    uses[op->x]+=2;
+    uses[op->y]++;
+    if(op->n >= 0x4) uses[0xF]++;
+    break;
+  case 0xf:
+    uses[op->x]++;
+    break;
+  }
+}
+
+static void flush(struct dynarec_t *const dynarec) {
+  memset(dynarec->blocks, 0, sizeof(dynarec->blocks));
+  dynarec->code_used=0;
+  dynarec->ops_used=0;
+  dynarec->flushes++;
+}
+
+static struct block_t *translate(struct dynarec_t *const dynarec, const struct chip8_t *const chip8, uint16_t start) {
+  struct instruction_t ops[DYNAREC_MAX_BLOCK];
+  uint16_t length=0, pc=start;
+  if(start > RAM_MASK-1) return NULL;
+  while(length < DYNAREC_MAX_BLOCK && pc <= RAM_MASK-1) {
+    decode(ops+length, fetch(chip8, pc), chip8->quirks);
+    const int kind=classify(ops+length++, chip8->quirks);
+    pc+=INSTRUCTION_SIZE;
+    if(kind == NATIVE_END || kind == HELPER_END) break;
+  }
+
+  uint32_t uses[16]={ 0 };
+  for(uint16_t at=0; at<length; ++at) count_uses(ops+at, uses);
+  struct translation_t t={ .dynarec=dynarec, .start=start, .length=length };
+  memset(t.pinned, -1, sizeof(t.pinned));
+  for(size_t reg=0; reg<sizeof(pinnable); ++reg) {
+    int best=-1;
+    for(int x=0; x<16; ++x)
+      if(t.pinned[x] < 0 && uses[x] && (best < 0 || uses[x] > uses[best])) best=x;
+    if(best < 0) break;
+    t.pinned[best]=pinnable[reg];
+  }
+
+  for(int attempt=0; attempt<2; ++attempt) {
+    t.at=dynarec->code+dynarec->code_used;
+    t.limit=dynarec->code+DYNAREC_CODE_SIZE;
+    uint8_t *const entry=t.at;
+    int overflow=0;
+    emit_prologue(&t);
+    t.body=t.at;
+    pc=start;
+    for(uint16_t at=0; at<length && !overflow; ++at, pc+=INSTRUCTION_SIZE) {
+      const int kind=classify(ops+at, chip8->quirks);
+      if(kind == NATIVE || kind == NATIVE_END) emit_native(&t, pc, ops+at);
+      else overflow=emit_helper(&t, pc, ops+at);
+    }
+    const int kind=classify(ops+length-1, chip8->quirks);
+    if(kind == NATIVE || kind == HELPER) emit_exit(&t, pc);
+    else if(kind == HELPER_END) emit_epilogue(&t);
+    if(!overflow && t.at <= t.limit) {
+      struct block_t *const block=dynarec->blocks+start;
+      block->code=(block_entry)(uintptr_t)entry;
+      block->end=start+length*INSTRUCTION_SIZE;
+      block->length=length;
+      dynarec->code_used=t.at-dynarec->code;
+      dynarec->translated++;
+      return block;
+    }
+    flush(dynarec);
+  }
+  return NULL;
+}
+
+static void invalidate(void *context, uint16_t addr, uint16_t size) {
+  struct dynarec_t *const dynarec=context;
+  // A block covers at most DYNAREC_MAX_BLOCK instructions, so only blocks
+  // starting in that window before the write can overlap it.
+  const int first=(int)addr-DYNAREC_MAX_BLOCK*INSTRUCTION_SIZE;
+  for(int start=first < 0 ? 0 : first; start < addr+size && start <= RAM_MASK; ++start) {
+    struct block_t *const block=dynarec->blocks+start;
+    if(block->code && block->end > addr) block->code=NULL;
+  }
+}
+
+struct dynarec_t *dynarec_create() {
+  struct dynarec_t *const dynarec=calloc(1, sizeof(struct dynarec_t));
+  if(!dynarec) return NULL;
+  dynarec->code=mmap(NULL, DYNAREC_CODE_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(dynarec->code == MAP_FAILED) {
+    free(dynarec);
+    return NULL;
+  }
+  return dynarec;
+}
+
+void dynarec_destroy(struct dynarec_t *const dynarec) {
+  if(!dynarec) return;
+  munmap(dynarec->code, DYNAREC_CODE_SIZE);
+  free(dynarec);
+}
+
+void dynarec_attach(struct dynarec_t *const dynarec, struct chip8_t *const chip8) {
+  flush(dynarec);
+  chip8->on_write=invalidate;
+  chip8->on_write_context=dynarec;
+}
+
+void dynarec_run(struct dynarec_t *const dynarec, struct chip8_t *const chip8, uint64_t cycles) {
+  while(cycles) {
+    const uint16_t pc=chip8->pc & RAM_MASK;
+    struct block_t *block=dynarec->blocks+pc;
+    if(!block->code) block=translate(dynarec, chip8, pc);
+    if(!block || block->length > cycles || pc != chip8->pc) {
+      cycle(chip8);
+      cycles--;
+      continue;
+    }
+    cycles=block->code(chip8, cycles);
+  }
+}
+
+#else
+
+struct dynarec_t *dynarec_create() {
+  return NULL;
+}
+
+void dynarec_destroy(struct dynarec_t *const dynarec) {
+  (void)dynarec;
+}
+
+void dynarec_attach(struct dynarec_t *const dynarec, struct chip8_t *const chip8) {
+  (void)dynarec;
+  (void)chip8;
+}
+
+void dynarec_run(struct dynarec_t *const dynarec, struct chip8_t *const chip8, uint64_t cycles) {
+  (void)dynarec;
+  while(cycles--) cycle(chip8);
+}
+
+#endif
+
+uint64_t dynarec_lockstep(struct dynarec_t *const dynarec, struct chip8_t *const chip8, struct chip8_t *const reference, uint64_t cycles) {
+  uint64_t done=0;
+  while(done < cycles) {
+    const uint16_t pc=chip8->pc;
+    uint64_t step=1;
+#if defined(__x86_64__) && !(CHIP8_TRACE || CHIP8_PROFILE)
+    const struct block_t *const block=dynarec->blocks+(chip8->pc & RAM_MASK);
+    if(block->code && block->length <= cycles-done) step=block->length;
+#endif
+    dynarec_run(dynarec, chip8, step);
+    for(uint64_t c=0; c<step; ++c) cycle(reference);
+    if(!same_state(chip8, reference)) {
+      fprintf(stderr, "[ERROR] dynarec diverged after %lu cycles, block at 0x%04X\n", done, pc);
+      break;
+    }
+    done+=step;
+  }
+  return done;
+}
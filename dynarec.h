@@ -0,0 +1,50 @@
+#ifndef DYNAREC_H
+#define DYNAREC_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+// Translates straight-line runs of CHIP-8 instructions into x86-64 code.
+// Only available on x86-64; dynarec_create() returns NULL elsewhere or when
+// the host refuses executable memory, and callers fall back to cycle().
+
+#define DYNAREC_CODE_SIZE (1<<20)
+#define DYNAREC_MAX_BLOCK 64
+#define DYNAREC_MAX_OPS (1<<14)
+
+// Runs the block at least once and returns what is left of `budget`; blocks
+// that jump back to their own start repeat while the budget allows.
+typedef uint64_t (*block_entry)(struct chip8_t *chip8, uint64_t budget);
+
+struct block_t {
+  block_entry code;
+  uint16_t end; // first address past the block
+  uint16_t length; // instructions, so cycle accounting matches cycle()
+};
+
+struct dynarec_t {
+  uint8_t *code;
+  size_t code_used;
+  struct block_t blocks[1<<12];
+  // Operands handed to interpreter handlers for instructions that are not
+  // translated natively.
+  struct instruction_t ops[DYNAREC_MAX_OPS];
+  size_t ops_used;
+  uint64_t translated, flushes;
+};
+
+struct dynarec_t *dynarec_create();
+void dynarec_destroy(struct dynarec_t *const dynarec);
+// Hooks chip8->on_write so Fx33/Fx55 stores drop the blocks they hit.
+void dynarec_attach(struct dynarec_t *const dynarec, struct chip8_t *const chip8);
+// Runs exactly `cycles` instructions, falling back to cycle() when the
+// next block would overshoot.
+void dynarec_run(struct dynarec_t *const dynarec, struct chip8_t *const chip8, uint64_t cycles);
+// Runs the same instructions through dynarec_run() on `chip8` and cycle() on
+// `reference`, a copy without on_write, comparing the state after every
+// block. Returns the number of cycles executed before the first mismatch,
+// or `cycles` if none.
+uint64_t dynarec_lockstep(struct dynarec_t *const dynarec, struct chip8_t *const chip8, struct chip8_t *const reference, uint64_t cycles);
+
+#endif
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "aot.h"
+#include "catalog.h"
+#include "chip8.h"
+#include "dynarec.h"
+#include "input.h"
+#include "runner.h"
+#include "sound.h"
+#include "state.h"
+#include "profile.h"
+#include "trace.h"
+
+// No window, no pacing and no rendering: the core runs back to back until the
+// requested instruction count is reached, then the final screen is dumped so
+// ROM regression jobs can diff it. Timers still tick once every `ipf`
+// instructions, as they would at 60 Hz in the window.
+
+#define DEFAULT_CYCLES 1000000
+
+// At the current resolution, one character per pixel.
+void dump_frame_buffer(FILE *const out, const struct chip8_t *const chip8) {
+  // ISO C before C23 will not add the const implicitly.
+  const uint64_t (*const rows)[HIRES_HEIGHT]=(const uint64_t (*)[HIRES_HEIGHT])chip8->frame_buffer;
+  for(int y=0; y<screen_height(chip8); ++y) {
+    for(int x=0; x<screen_width(chip8); ++x)
+      fputc(get_pixel(rows, x, y) ? '#' : '.', out);
+    fputc('\n', out);
+  }
+}
+
+void help() {
+  printf("Help: ./chip8-headless [--core=interpreter|threaded|dynarec|lockstep] [--ipf=N] [--seed=N] [--input=FILE] [--load-state=FILE] [--save-state=FILE] [--catalog=FILE] [--quirks=modern|vip|schip|xochip] [--audio=FILE] [--aot=FILE] [--no-skip-idle] <path_to_rom_file>.ch8 [cycles]\n");
+  printf("  --ipf=N       instructions per 60 Hz timer tick (default %d, 0 never ticks)\n", DEFAULT_IPF);
+  printf("  --seed=N      Cxkk seed (default %d)\n", DEFAULT_SEED);
+  printf("  --input=FILE  keypad script or a log recorded with ./main --record, see input.h;\n");
+  printf("                its seed, ipf and quirks apply unless given here, and cycles default to its last event\n");
+  printf("  --catalog=FILE  take the rom by name or hash from a catalog built with chip8-catalog,\n");
+  printf("                along with its quirk profile\n");
+  printf("  --quirks=NAME quirk profile (default: the catalog's, else modern)\n");
+  printf("  --audio=FILE  write what the beeper plays as a %d Hz 16-bit mono WAV, one frame per timer tick\n", SOUND_RATE);
+  printf("  --aot=FILE    run the rom through an image built for it with chip8-aot\n");
+  printf("  --no-skip-idle  run idle loops instruction by instruction instead of skipping them\n");
+  printf("  --load-state=FILE, --save-state=FILE  resume from / checkpoint to a snapshot of the same rom, see state.h\n");
+}
+
+// Snapshots are taken against the freshly booted rom.
+int load_state_file(const char *const file_name, struct chip8_t *const chip8, const struct chip8_t *const base) {
+  static uint8_t buffer[STATE_MAX_SIZE];
+  FILE *const file=fopen(file_name, "rb");
+  if(!file) return -1;
+  const size_t size=fread(buffer, 1, sizeof(buffer), file);
+  fclose(file);
+  return chip8_load_state(chip8, base, buffer, size);
+}
+
+int save_state_file(const char *const file_name, const struct chip8_t *const chip8, const struct chip8_t *const base) {
+  static uint8_t buffer[STATE_MAX_SIZE];
+  const size_t size=chip8_save_state(chip8, base, buffer, sizeof(buffer));
+  FILE *const file=fopen(file_name, "wb");
+  if(!file) return -1;
+  const size_t written=fwrite(buffer, 1, size, file);
+  fclose(file);
+  return written == size ? 0 : -1;
+}
+
+// Same slicing as run(), but every step goes through dynarec_lockstep()
+// against a reference interpreter instance that sees the same input.
+int run_lockstep(const struct run_t *const config, struct chip8_t *const chip8, struct chip8_t *const reference, uint64_t cycles) {
+  uint64_t done=0, frame=0;
+  while(done < cycles) {
+    const uint64_t next_event=config->input ? apply_input(config->input, chip8, done) : UINT64_MAX;
+    reference->keys=chip8->keys;
+    uint64_t step=cycles-done;
+    if(config->ipf && step > config->ipf-frame) step=config->ipf-frame;
+    if(step > next_event-done) step=next_event-done;
+    if(dynarec_lockstep(config->dynarec, chip8, reference, step) != step) return -1;
+    done+=step;
+    frame+=step;
+    if(config->ipf && frame == config->ipf) {
+      tick_timers(chip8);
+      tick_timers(reference);
+      frame=0;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  static struct chip8_t chip8, reference, base;
+  struct run_t config={ .core=CORE_INTERPRETER, .ipf=DEFAULT_IPF, .skip_idle=1 };
+  struct input_script_t input;
+  const char *load_state=NULL, *save_state=NULL, *catalog_file=NULL, *audio=NULL, *aot=NULL;
+  static struct beeper_t beeper;
+  uint64_t seed=DEFAULT_SEED;
+  enum quirks_t quirks=QUIRKS_modern;
+  int has_seed=0, has_ipf=0, has_quirks=0;
+  int arg=1;
+  for(; arg<argc && !strncmp(argv[arg], "--", 2); ++arg) {
+    int unknown=0;
+    if(!strncmp(argv[arg], "--core=", 7)) unknown=parse_core(argv[arg]+7, &config.core);
+    else if(!strncmp(argv[arg], "--ipf=", 6)) {
+      config.ipf=strtoull(argv[arg]+6, NULL, 10);
+      has_ipf=1;
+    }
+    else if(!strncmp(argv[arg], "--seed=", 7)) {
+      seed=strtoull(argv[arg]+7, NULL, 0);
+      has_seed=1;
+    }
+    else if(!strncmp(argv[arg], "--input=", 8)) {
+      if(load_input_script(argv[arg]+8, &input)) {
+        fprintf(stderr, "[ERROR] could not read input script %s\n", argv[arg]+8);
+        exit(80);
+      }
+      config.input=&input;
+    }
+    else if(!strncmp(argv[arg], "--load-state=", 13)) load_state=argv[arg]+13;
+    else if(!strncmp(argv[arg], "--save-state=", 13)) save_state=argv[arg]+13;
+    else if(!strncmp(argv[arg], "--catalog=", 10)) catalog_file=argv[arg]+10;
+    else if(!strncmp(argv[arg], "--audio=", 8)) audio=argv[arg]+8;
+    else if(!strncmp(argv[arg], "--aot=", 6)) aot=argv[arg]+6;
+    else if(!strcmp(argv[arg], "--no-skip-idle")) config.skip_idle=0;
+    else if(!strncmp(argv[arg], "--quirks=", 9)) {
+      unknown=parse_quirks(argv[arg]+9, &quirks);
+      has_quirks=1;
+    }
+    else unknown=1;
+    if(unknown) {
+      fprintf(stderr, "[ERROR] unknown option %s\n", argv[arg]);
+      help();
+      exit(68);
+    }
+  }
+  if(argc-arg < 1 || argc-arg > 2) {
+    fprintf(stderr, "[ERROR] no rom file was specified\n");
+    help();
+    exit(68);
+  }
+  // A recorded log carries everything needed to replay it.
+  if(config.input) {
+    if(!has_seed && input.has_seed) seed=input.seed;
+    if(!has_ipf && input.has_ipf) config.ipf=input.ipf;
+    if(!has_quirks && input.has_quirks) {
+      quirks=input.quirks;
+      has_quirks=1;
+    }
+  }
+  if(aot) {
+    if(config.core == CORE_LOCKSTEP) {
+      fprintf(stderr, "[ERROR] --aot cannot be combined with the lockstep core, see chip8-aot --verify\n");
+      exit(68);
+    }
+    config.core=CORE_AOT;
+  }
+  if(audio && (!config.ipf || config.core == CORE_LOCKSTEP)) {
+    fprintf(stderr, "[ERROR] --audio needs timers that tick and a core other than lockstep\n");
+    exit(68);
+  }
+  uint64_t cycles=DEFAULT_CYCLES;
+  if(argc-arg == 2) cycles=strtoull(argv[arg+1], NULL, 10);
+  else if(config.input && input.count) cycles=input.events[input.count-1].cycle;
+  struct chip8_arena_t arena;
+  if(arena_init(&arena, 3)) {
+    fprintf(stderr, "[ERROR] out of memory\n");
+    exit(81);
+  }
+  arena_attach(&arena, &chip8);
+  arena_attach(&arena, &reference);
+  arena_attach(&arena, &base);
+  struct rom_catalog_t catalog;
+  if(catalog_file && catalog_open(catalog_file, &catalog)) {
+    fprintf(stderr, "[ERROR] could not open catalog %s\n", catalog_file);
+    exit(80);
+  }
+  const ssize_t size=catalog_file ? catalog_boot(&catalog, &chip8, argv[arg]) : boot(&chip8, argv[arg]);
+  if(catalog_file) catalog_close(&catalog);
+  if(size < 0) {
+    fprintf(stderr, "[ERROR] could not read rom %s\n", argv[arg]);
+    exit(80);
+  }
+  seed_random(&chip8, seed);
+  if(has_quirks) set_quirks(&chip8, quirks);
+  if(config.core == CORE_DYNAREC || config.core == CORE_LOCKSTEP) {
+    config.dynarec=dynarec_create();
+    if(config.dynarec) dynarec_attach(config.dynarec, &chip8);
+    else {
+      fprintf(stderr, "[WARNING] dynarec unavailable, using the interpreter\n");
+      config.core=CORE_INTERPRETER;
+    }
+  }
+  copy_state(&base, &chip8);
+  if(load_state && load_state_file(load_state, &chip8, &base)) {
+    fprintf(stderr, "[ERROR] could not load state %s\n", load_state);
+    exit(80);
+  }
+  // After the state, so blocks its ram no longer matches stay off.
+  if(aot) {
+    config.aot=aot_load(aot);
+    if(!config.aot) {
+      fprintf(stderr, "[ERROR] could not load aot image %s\n", aot);
+      exit(80);
+    }
+    const int enabled=aot_attach(config.aot, &chip8);
+    if(enabled < 0) {
+      fprintf(stderr, "[ERROR] %s was not built for the %s quirks\n", aot, quirks_name(chip8.quirks));
+      exit(68);
+    }
+    if(!enabled) fprintf(stderr, "[WARNING] %s does not match this rom, running it interpreted\n", aot);
+  }
+  if(audio) {
+    beeper_init(&beeper, NULL);
+    if(beeper_open_file(&beeper, audio)) {
+      fprintf(stderr, "[ERROR] could not write %s\n", audio);
+      exit(80);
+    }
+    beeper_set(&beeper, 0, chip8.st != 0);
+    config.beeper=&beeper;
+  }
+#if CHIP8_TRACE
+  trace_install_handlers();
+#endif
+  int status=EXIT_SUCCESS;
+  const double start=now();
+  if(config.core == CORE_LOCKSTEP) {
+    copy_state(&reference, &chip8);
+    reference.on_write=NULL;
+    if(run_lockstep(&config, &chip8, &reference, cycles)) status=90;
+  }
+  else {
+    uint64_t executed;
+    run(&config, &chip8, cycles, &executed);
+  }
+  const double elapsed=now()-start;
+#if CHIP8_TRACE
+  trace_dump(TRACE_CRASH_FILE);
+#endif
+#if CHIP8_PROFILE
+  profile_report(stderr);
+  if(profile_write_flat(PROFILE_FILE)) fprintf(stderr, "[WARNING] could not write %s\n", PROFILE_FILE);
+#endif
+  if(save_state && save_state_file(save_state, &chip8, &base)) {
+    fprintf(stderr, "[ERROR] could not save state %s\n", save_state);
+    status=80;
+  }
+  if(audio && beeper_close_file(&beeper)) {
+    fprintf(stderr, "[ERROR] could not write %s\n", audio);
+    status=80;
+  }
+  dump_frame_buffer(stdout, &chip8);
+  fprintf(stderr, "%lu cycles in %.3fs (%.0f IPS)\n", cycles, elapsed, elapsed > 0 ? cycles/elapsed : 0);
+  if(config.input) free_input_script(config.input);
+  dynarec_destroy(config.dynarec);
+  aot_unload(config.aot);
+  arena_free(&arena);
+  return status;
+}
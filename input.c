@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "input.h"
+
+int load_input_script(const char *const file_name, struct input_script_t *const script) {
+  memset(script, 0, sizeof(*script));
+  FILE *const file=fopen(file_name, "r");
+  if(!file) return -1;
+  size_t capacity=0;
+  char line[256];
+  int status=0;
+  while(!status && fgets(line, sizeof(line), file)) {
+    if(line[0] == '#' || line[0] == '\n') continue;
+    unsigned long long value;
+    char name[16];
+    if(sscanf(line, "seed %llu", &value) == 1) {
+      script->seed=value;
+      script->has_seed=1;
+      continue;
+    }
+    if(sscanf(line, "ipf %llu", &value) == 1) {
+      script->ipf=value;
+      script->has_ipf=1;
+      continue;
+    }
+    if(sscanf(line, "quirks %15s", name) == 1) {
+      status=parse_quirks(name, &script->quirks);
+      script->has_quirks=1;
+      continue;
+    }
+    unsigned long long cycle;
+    int keys;
+    if(sscanf(line, "%llu %i", &cycle, &keys) != 2 || keys < 0 || keys > 0xFFFF
+       || (script->count && cycle < script->events[script->count-1].cycle)) {
+      status=-1;
+      break;
+    }
+    if(script->count == capacity) {
+      capacity=capacity ? capacity*2 : 64;
+      struct input_event_t *const grown=realloc(script->events, capacity*sizeof(struct input_event_t));
+      if(!grown) {
+        status=-1;
+        break;
+      }
+      script->events=grown;
+    }
+    script->events[script->count++]=(struct input_event_t){ .cycle=cycle, .keys=keys };
+  }
+  fclose(file);
+  if(status) free_input_script(script);
+  return status;
+}
+
+void free_input_script(struct input_script_t *const script) {
+  free(script->events);
+  memset(script, 0, sizeof(*script));
+}
+
+uint64_t apply_input(struct input_script_t *const script, struct chip8_t *const chip8, uint64_t cycle) {
+  while(script->next < script->count && script->events[script->next].cycle <= cycle)
+    chip8->keys=script->events[script->next++].keys;
+  return script->next < script->count ? script->events[script->next].cycle : UINT64_MAX;
+}
+
+int open_input_log(const char *const file_name, struct input_log_t *const log, uint64_t seed, uint64_t ipf, enum quirks_t quirks) {
+  log->file=fopen(file_name, "w");
+  if(!log->file) return -1;
+  log->keys=0;
+  fprintf(log->file, "seed %lu\nipf %lu\nquirks %s\n", seed, ipf, quirks_name(quirks));
+  fflush(log->file);
+  return 0;
+}
+
+void log_input(struct input_log_t *const log, const struct chip8_t *const chip8, uint64_t cycle) {
+  if(chip8->keys == log->keys) return;
+  log->keys=chip8->keys;
+  // Flushed right away so a crash still leaves a usable log.
+  fprintf(log->file, "%lu 0x%04X\n", cycle, log->keys);
+  fflush(log->file);
+}
+
+void close_input_log(struct input_log_t *const log, uint64_t cycle) {
+  fprintf(log->file, "%lu 0x%04X\n", cycle, log->keys);
+  fclose(log->file);
+  log->file=NULL;
+}
@@ -0,0 +1,54 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "chip8.h"
+
+// Input scripts are text files with one keypad change per line:
+//   <cycle> <keys>
+// where keys is the 16-bit mask of keys held from that cycle on (bit n is
+// key n, hex with 0x or decimal). Lines starting with '#' are ignored and
+// cycles must not decrease. Three optional lines pin the rest of what a run
+// depends on, so a recorded log replays bit for bit:
+//   seed <n>        passed to seed_random() after boot
+//   ipf <n>         instructions per timer tick it was recorded at
+//   quirks <name>   quirk profile it was recorded with
+
+struct input_event_t {
+  uint64_t cycle;
+  uint16_t keys;
+};
+
+struct input_script_t {
+  struct input_event_t *events;
+  size_t count, next;
+  uint64_t seed, ipf;
+  enum quirks_t quirks;
+  uint8_t has_seed, has_ipf, has_quirks;
+};
+
+// Writes the keypad of a live session in the format above.
+struct input_log_t {
+  FILE *file;
+  uint16_t keys;
+};
+
+// Returns 0 on success, -1 if the file cannot be read or is malformed.
+int load_input_script(const char *const file_name, struct input_script_t *const script);
+void free_input_script(struct input_script_t *const script);
+// Applies every event due at or before `cycle` and returns the cycle of the
+// next pending one, or UINT64_MAX when the script is exhausted.
+uint64_t apply_input(struct input_script_t *const script, struct chip8_t *const chip8, uint64_t cycle);
+
+// Returns -1 if the file cannot be created.
+int open_input_log(const char *const file_name, struct input_log_t *const log, uint64_t seed, uint64_t ipf, enum quirks_t quirks);
+// Call before running `cycle`; only changes of the keypad are written.
+void log_input(struct input_log_t *const log, const struct chip8_t *const chip8, uint64_t cycle);
+// Ends the log with the keypad held at `cycle`, which marks how long the
+// session ran.
+void close_input_log(struct input_log_t *const log, uint64_t cycle);
+
+#endif
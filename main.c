@@ -1,457 +1,391 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
 #include <string.h>
 #include <stdint.h>
-#include <fcntl.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <raylib.h>
 
-#define ORG 0x200
+#include "chip8.h"
+#include "input.h"
+#include "rewind.h"
+#include "sound.h"
+#include "profile.h"
+#include "trace.h"
+#include "triple_buffer.h"
+#include "catalog.h"
 
-#define SCREEN_WIDTH 64
-#define SCREEN_HEIGHT 32
 #define SCALE 15
 #define WIDTH SCALE*SCREEN_WIDTH
 #define HEIGHT SCALE*SCREEN_HEIGHT
 
-#define PIXELS_PER_ROW 64
-#define PIXELS_PER_COL 32
-#define PADDING 1
 #define PIXEL_WIDTH WIDTH/PIXELS_PER_ROW
 #define PIXEL_HEIGHT HEIGHT/PIXELS_PER_COL
-#define TOTAL_PIXELS (WIDTH*HEIGHT)/(PIXEL_WIDTH*PIXEL_HEIGHT)
-#define INSTRUCTION_SIZE 2
 
-#define FPS 60
+#define FPS TIMER_HZ
+// Uncapped mode runs instructions in chunks of this size until the frame's
+// share of emulation time is used up; the rest is slack so the thread still
+// wakes up on time for the next frame.
+#define UNCAPPED_CHUNK 1024
+#define UNCAPPED_BUDGET 0.8
+// Held down, steps back one frame per emulated frame.
+#define REWIND_KEY KEY_BACKSPACE
+// A frame taking this many periods or more counts as late.
+#define LATE_FRAME 1.5
+
+// Emulation runs on its own thread, paced at FPS by its own clock, and
+// publishes every changed screen through a triple buffer. The window thread
+// (raylib is single threaded) samples input and draws the newest screen at
+// display rate, so neither a slow draw nor vsync can stall cycle().
+// Everything they share is below.
+static _Atomic uint16_t keypad_mask;
+static _Atomic int running=1;
+static _Atomic int rewinding;
+static _Atomic uint64_t instructions; // executed so far, for the IPS title
+#if CHIP8_TRACE
+static _Atomic int dump_requested;
+#endif
+static struct triple_buffer_t frames;
+// Filled by the emulation thread, drained by the audio device's thread.
+static struct sample_ring_t samples;
+
+struct frame_stats_t {
+  uint64_t frames, late;
+  uint64_t dropped; // emulation: published but replaced before display
+  uint64_t repeated; // render: drawn with no new frame ready
+  double total, worst; // seconds
+};
 
-// TODO: convert registers to memory pointers
-struct chip8_t {
-  uint8_t v[16];
-  uint16_t i, pc;
-  uint8_t sp, dt, st;
-  uint16_t stack[12];
-  uint8_t ram[1<<12];
-  uint8_t frame_buffer[SCREEN_HEIGHT*SCREEN_WIDTH];
-  uint8_t keypad[16];
-  //uint16_t *i, *pc, *stack;
-  //uint8_t *sp, *dt, *st;
-  //uint16_t *v1, *v2, *v3, *v4, *v5, *v6, *v7, *v8, *v9, *va, *vb, *vc, *vd, *ve, *vf;
-  //uint8_t *v_regs, *frame_buffer;
+struct emulator_t {
+  struct chip8_t chip8;
+  uint32_t ipf;
+  int uncapped;
+  struct rewind_t *history;
+  struct input_log_t log;
+  struct beeper_t *beeper; // NULL when muted
+  uint64_t executed;
+  struct frame_stats_t stats;
 };
 
-typedef void (*decode_entry)(struct chip8_t *chip8, uint16_t instruction);
+// The display lives in a 128x64 RGBA texture drawn as one quad filling the
+// window; low resolution only uses its top left quarter. It is only rebuilt
+// and uploaded when a new frame comes in.
+static Texture2D screen;
+static Color screen_pixels[HIRES_WIDTH*HIRES_HEIGHT];
+static uint8_t screen_hires;
+
+static double monotonic() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec+now.tv_nsec*1e-9;
+}
 
-void set_pixel(uint8_t pixels[], uint16_t pos_x, uint16_t pos_y, uint8_t bit) {
-  printf("%d %d %d\n", pos_x, pos_y, (pos_y*(PIXELS_PER_ROW))+pos_x);
-  pixels[(pos_y*PIXELS_PER_ROW)+pos_x]=bit;
+static void count_frame(struct frame_stats_t *const stats, double seconds) {
+  stats->frames++;
+  stats->total+=seconds;
+  if(seconds > stats->worst) stats->worst=seconds;
+  if(seconds >= LATE_FRAME/FPS) stats->late++;
 }
 
-void invert_pixel(uint8_t pixels[], uint16_t pos_x, uint16_t pos_y) {
-  printf("%d %d %d\n", pos_x, pos_y, (pos_y*(PIXELS_PER_ROW))+pos_x);
-  pixels[(pos_y*(PIXELS_PER_ROW))+pos_x]=!pixels[(pos_y*(PIXELS_PER_ROW))+pos_x];
+static void print_stats(const char *const name, const struct frame_stats_t *const stats, const char *const extra, uint64_t count) {
+  printf("%s: %lu frames, %.2f ms average, %.2f ms worst, %lu late, %lu %s\n", name, stats->frames,
+         stats->frames ? 1e3*stats->total/stats->frames : 0, 1e3*stats->worst, stats->late, count, extra);
 }
 
 void init() {
   InitWindow(WIDTH, HEIGHT, "Chip-8 emulator");
   SetTargetFPS(FPS);
+  Image image=GenImageColor(HIRES_WIDTH, HIRES_HEIGHT, BLACK);
+  screen=LoadTextureFromImage(image);
+  UnloadImage(image);
+  SetTextureFilter(screen, TEXTURE_FILTER_POINT);
 }
 
-void render(uint8_t pixels[]) {
-  BeginDrawing();
-  for(int i=0; i<TOTAL_PIXELS; ++i) {
-    uint16_t pos_x=(i%(PIXELS_PER_ROW))*PIXEL_WIDTH;
-    uint16_t pos_y=(i/(PIXELS_PER_ROW))*PIXEL_HEIGHT;
-    DrawRectangle(
-      pos_x
-      , pos_y
-      , PIXEL_WIDTH-(PADDING)
-      , PIXEL_HEIGHT-(PADDING)
-      , pixels[i] ? WHITE : BLACK
-    );
+// `frame` is NULL when nothing changed since the last call.
+void render(const struct frame_t *const frame) {
+  if(frame) {
+    screen_hires=frame->hires;
+    const int width=screen_hires ? HIRES_WIDTH : SCREEN_WIDTH, height=screen_hires ? HIRES_HEIGHT : SCREEN_HEIGHT;
+    for(int y=0; y<height; ++y) {
+      Color *const line=screen_pixels+y*HIRES_WIDTH;
+      for(int x=0; x<width; ++x)
+        line[x]=get_pixel(frame->rows, x, y) ? WHITE : BLACK;
+    }
+    UpdateTexture(screen, screen_pixels);
   }
+  const Rectangle source={ 0, 0, screen_hires ? HIRES_WIDTH : SCREEN_WIDTH, screen_hires ? HIRES_HEIGHT : SCREEN_HEIGHT };
+  BeginDrawing();
+  DrawTexturePro(screen, source, (Rectangle){ 0, 0, WIDTH, HEIGHT }, (Vector2){ 0, 0 }, 0, WHITE);
   EndDrawing();
 }
 
 uint8_t exit_() {
+  UnloadTexture(screen);
   CloseWindow();
   return EXIT_SUCCESS;
 }
 
-size_t read_file(const char *const file_name, uint8_t *buffer) {
-  int fd=open(file_name, O_RDONLY);
-  if(fd == -1) exit(80);
-  off_t raw_bytes=lseek(fd, 0, SEEK_END);
-  lseek(fd, 0, SEEK_SET);
-  ssize_t bytes_read=read(fd, buffer, raw_bytes);
-  buffer[bytes_read]='\0';
-  close(fd);
-  return bytes_read;
-}
-
-size_t boot(struct chip8_t *const chip8, const char *const rom_name) {
-  //chip8->pc=chip8->memory+ORG;
-  chip8->pc=ORG;
-  chip8->sp=0;
-  chip8->dt=chip8->st=0;
-  memset(chip8->frame_buffer, 0, SCREEN_WIDTH*SCREEN_HEIGHT);
-  memset(chip8->keypad, 0, 16);
-  uint8_t fonts[5*16] = {
-    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-    0x20, 0x60, 0x20, 0x20, 0x70, // 1
-    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+// Samples the host keyboard into keypad_mask, bit k for CHIP-8 key k. The
+// emulation thread reads it whole once per frame, so it never sees half an
+// update.
+void process_input() {
+  // 1 2 3 C / 4 5 6 D / 7 8 9 E / A 0 B F on the left of a QWERTY keyboard.
+  const int keyboard[16]={
+    KEY_ONE, KEY_TWO, KEY_THREE, KEY_FOUR,
+    KEY_Q, KEY_W, KEY_E, KEY_R,
+    KEY_A, KEY_S, KEY_D, KEY_F,
+    KEY_Z, KEY_X, KEY_C, KEY_V
   };
-  memcpy(chip8->ram, fonts, 40);
-
-  uint8_t buffer[0xFFF-0x200];
-  ssize_t bytes=read_file(rom_name, buffer);
-  memmove(chip8->ram+ORG, buffer, bytes);
-  return bytes;
+  const uint8_t keypad[16]={
+    0x1, 0x2, 0x3, 0xc,
+    0x4, 0x5, 0x6, 0xd,
+    0x7, 0x8, 0x9, 0xe,
+    0xa, 0x0, 0xb, 0xf
+  };
+  uint16_t keys=0;
+  for(int k=0; k<16; ++k) if(IsKeyDown(keyboard[k])) keys|=1 << keypad[k];
+  atomic_store_explicit(&keypad_mask, keys, memory_order_relaxed);
 }
 
-void increment_pc(uint16_t *const pc, uint16_t increment) {
-  (*pc)+=(increment*INSTRUCTION_SIZE);
+// Runs as many instructions as fit in the frame's emulation budget and
+// returns how many that was. The beeper hears st changes per chunk, placed
+// in the frame by how much of the budget had gone by.
+uint64_t run_uncapped_frame(struct chip8_t *const chip8, struct beeper_t *const beeper) {
+  const double start=monotonic(), budget=UNCAPPED_BUDGET/FPS;
+  uint64_t executed=0;
+  // Fx0A with no key down gives the rest of the frame back, and so does an
+  // idle loop: nothing it does shows before the tick.
+  while(!waiting_for_key(chip8) && monotonic()-start < budget) {
+    uint64_t ran=0;
+    const int idle=idle_loop(chip8, UNCAPPED_CHUNK, &ran) != 0;
+    executed+=ran;
+    if(idle) break;
+    run_cycles(chip8, UNCAPPED_CHUNK);
+    executed+=UNCAPPED_CHUNK;
+    if(beeper && (chip8->st != 0) != beeper->on)
+      beeper_set(beeper, (monotonic()-start)/budget*SOUND_FRAME_SAMPLES, chip8->st != 0);
+  }
+  if(beeper) beeper_end_frame(beeper);
+  tick_timers(chip8);
+  if(beeper) beeper_set(beeper, 0, chip8->st != 0);
+  return executed;
 }
 
-uint16_t get_4_bits(uint16_t instruction, uint8_t start_bit, uint8_t size) {
-  return (instruction >> ((start_bit-1)*4)) & (0xFFFF >> (4-size)*4);
+void play_samples(void *buffer, unsigned int count) {
+  const size_t played=sample_ring_pop(&samples, buffer, count);
+  memset((int16_t *)buffer+played, 0, (count-played)*sizeof(int16_t));
 }
 
-uint8_t process_input(struct chip8_t *const chip8) {
-  int key=-1;
-  char keyboard[17]="1234qwerasdfzxcv";
-  uint8_t keypad[17]={
-    0x1, 0x2, 0x3, 0xc
-    ,0x4, 0x5, 0x6, 0xd
-    ,0x7, 0x8, 0x9, 0xe
-    ,0xa, 0x0, 0xb, 0xf
-  };
-
-  for(size_t i=0; i<strlen(keyboard); ++i) {
-    if(IsKeyDown(keyboard[i])) {
-      chip8->keypad[keypad[i]]=1;
-      key=keypad[i];
+void *emulate(void *argument) {
+  struct emulator_t *const emulator=argument;
+  struct chip8_t *const chip8=&emulator->chip8;
+  const long period=1000000000/FPS;
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  while(atomic_load_explicit(&running, memory_order_relaxed)) {
+    const double start=monotonic();
+    chip8->keys=atomic_load_explicit(&keypad_mask, memory_order_relaxed);
+    if(emulator->log.file) log_input(&emulator->log, chip8, emulator->executed);
+    const int back=emulator->history && atomic_load_explicit(&rewinding, memory_order_relaxed);
+    if(back) {
+      rewind_pop(emulator->history, chip8);
+      // Stepping back is silent.
+      if(emulator->beeper) {
+        beeper_set(emulator->beeper, 0, 0);
+        beeper_end_frame(emulator->beeper);
+        beeper_set(emulator->beeper, 0, chip8->st != 0);
+      }
     }
-    else if (IsKeyUp(keyboard[i])) {
-      chip8->keypad[keypad[i]]=0;
+    else if(emulator->uncapped) emulator->executed+=run_uncapped_frame(chip8, emulator->beeper);
+    else {
+      if(emulator->beeper) run_sound_frame(chip8, emulator->ipf, emulator->beeper);
+      else run_frame(chip8, emulator->ipf);
+      emulator->executed+=emulator->ipf;
     }
+    if(emulator->history && !back) rewind_push(emulator->history, chip8);
+    atomic_store_explicit(&instructions, emulator->executed, memory_order_relaxed);
+    if(chip8->draw) {
+      struct frame_t *const frame=triple_buffer_back(&frames);
+      memcpy(frame->rows, chip8->frame_buffer, sizeof(frame->rows));
+      frame->hires=chip8->hires;
+      frame->number=emulator->stats.frames;
+      emulator->stats.dropped+=triple_buffer_publish(&frames);
+      chip8->draw=0;
+    }
+#if CHIP8_TRACE
+    if(atomic_exchange(&dump_requested, 0)) trace_dump(TRACE_CRASH_FILE);
+#endif
+    count_frame(&emulator->stats, monotonic()-start);
+    deadline.tv_nsec+=period;
+    if(deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec-=1000000000;
+    }
+    // After a stall, start over from now instead of racing to catch up.
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec > deadline.tv_nsec)) deadline=now;
+    else clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
   }
-  return key;
-}
-
-
-void exec_op_0(struct chip8_t *chip8, uint16_t instruction) {
-  uint32_t remainding_bits=get_4_bits(instruction, 1, 3);
-  if(remainding_bits == 0x0e0) {
-    memset(chip8->frame_buffer, 0, SCREEN_WIDTH*SCREEN_HEIGHT);
-    increment_pc(&(chip8->pc), 1);
-    printf("cls\n");
-  }
-  else if(remainding_bits == 0x0ee) {
-    chip8->pc=chip8->stack[chip8->sp];
-    chip8->sp--;
-    printf("ret\n");
-  }
-  else {
-    chip8->pc=remainding_bits;
-    printf("sys 0x%04X\n", chip8->pc);
-  }
+  return NULL;
 }
 
-void exec_op_1(struct chip8_t *chip8, uint16_t instruction) {
-  uint16_t remainding_bits=get_4_bits(instruction, 1, 3);
-  chip8->pc=remainding_bits;
-  printf("jp 0x%04X\n", chip8->pc);
-}
-
-void exec_op_2(struct chip8_t *chip8, uint16_t instruction) {
-  uint32_t remainding_bits=get_4_bits(instruction, 1, 3);
-  increment_pc(&(chip8->pc), 1);
-  chip8->stack[chip8->sp]=chip8->pc;
-  chip8->pc=remainding_bits;
-  printf("call %d\n", chip8->pc);
+void help() {
+  printf("Help: ./main [--ipf=N|--uncapped] [--rewind=MiB] [--seed=N] [--record=FILE] [--audio-buffer=N] [--quirks=NAME] [--catalog=FILE] <path_to_rom_file>.ch8\n");
+  printf("  --ipf=N       instructions per 60 Hz frame (default %d)\n", DEFAULT_IPF);
+  printf("  --uncapped    run as many instructions as the frame allows and report IPS\n");
+  printf("  --rewind=MiB  history kept for stepping back with backspace (default %d, 0 disables)\n", DEFAULT_REWIND_MIB);
+  printf("  --seed=N      Cxkk seed (default: the current time)\n");
+  printf("  --record=FILE log the seed and every keypad change for ./chip8-headless --input=FILE;\n");
+  printf("                needs a fixed --ipf and turns rewind off\n");
+  printf("  --audio-buffer=N  samples the audio device asks for at a time (default %d, about %.1f ms;\n", DEFAULT_SOUND_BUFFER, 1e3*DEFAULT_SOUND_BUFFER/SOUND_RATE);
+  printf("                at most %d, 0 mutes)\n", MAX_SOUND_BUFFER);
+  printf("  --quirks=NAME quirk profile: modern, vip, schip or xochip (default: the catalog's, else modern)\n");
+  printf("  --catalog=FILE  take the rom by name or hash from a catalog built with chip8-catalog,\n");
+  printf("                along with its quirk profile\n");
 }
 
-void exec_op_3(struct chip8_t *chip8, uint16_t instruction) {
-  uint32_t register_x=get_4_bits(instruction, 3, 1);
-  uint8_t value=get_4_bits(instruction, 1, 2);
-  if(chip8->v[register_x] == value) {
-    increment_pc(&(chip8->pc), 2);
+int main(int argc, char **argv) {
+  static struct emulator_t emulator;
+  struct chip8_t *const chip8=&emulator.chip8;
+  uint32_t ipf=DEFAULT_IPF;
+  int uncapped=0;
+  size_t rewind_mib=DEFAULT_REWIND_MIB;
+  uint64_t seed=time(NULL);
+  const char *record=NULL;
+  uint32_t audio_buffer=DEFAULT_SOUND_BUFFER;
+  const char *catalog_file=NULL;
+  enum quirks_t quirks=QUIRKS_modern;
+  int has_quirks=0;
+  int arg=1;
+  for(; arg<argc && !strncmp(argv[arg], "--", 2); ++arg) {
+    if(!strncmp(argv[arg], "--ipf=", 6)) ipf=strtoul(argv[arg]+6, NULL, 10);
+    else if(!strcmp(argv[arg], "--uncapped")) uncapped=1;
+    else if(!strncmp(argv[arg], "--rewind=", 9)) rewind_mib=strtoul(argv[arg]+9, NULL, 10);
+    else if(!strncmp(argv[arg], "--seed=", 7)) seed=strtoull(argv[arg]+7, NULL, 0);
+    else if(!strncmp(argv[arg], "--record=", 9)) record=argv[arg]+9;
+    else if(!strncmp(argv[arg], "--audio-buffer=", 15)) audio_buffer=strtoul(argv[arg]+15, NULL, 10);
+    else if(!strncmp(argv[arg], "--catalog=", 10)) catalog_file=argv[arg]+10;
+    else if(!strncmp(argv[arg], "--quirks=", 9) && !parse_quirks(argv[arg]+9, &quirks)) has_quirks=1;
+    else {
+      fprintf(stderr, "[ERROR] unknown option %s\n", argv[arg]);
+      help();
+      exit(68);
+    }
   }
-  else increment_pc(&(chip8->pc), 1);
-  printf("se V%d, 0x%04X\n", register_x, value);
-}
-
-void exec_op_4(struct chip8_t *chip8, uint16_t instruction) {
-  uint32_t register_x=get_4_bits(instruction, 3, 1);
-  uint8_t value=get_4_bits(instruction, 1, 2);
-  if(chip8->v[register_x] != value) {
-    increment_pc(&(chip8->pc), 2);
+  if(argc-arg != 1) {
+    fprintf(stderr, "[ERROR] no rom file was specified\n");
+    help();
+    exit(68);
   }
-  else increment_pc(&(chip8->pc), 1);
-  printf("sne V%d, 0x%04X\n", register_x, value);
-}
-
-void exec_op_5(struct chip8_t *chip8, uint16_t instruction) {
-  uint32_t register_x=get_4_bits(instruction, 3, 1);
-  uint32_t register_y=get_4_bits(instruction, 2, 1);
-  if(chip8->v[register_x] == chip8->v[register_y])
-    increment_pc(&(chip8->pc), 2);
-  else
-    increment_pc(&(chip8->pc), 1);
-  printf("se V%d, V%d\n", register_x, register_y);
-}
-
-void exec_op_6(struct chip8_t *chip8, uint16_t instruction) {
-  uint8_t register_x=get_4_bits(instruction, 3, 1);
-  uint8_t value=get_4_bits(instruction, 1, 2);
-  chip8->v[register_x]=value;
-  printf("ld V%d, 0x%04X\n", register_x, value);
-  increment_pc(&chip8->pc, 1);
-}
-
-void exec_op_7(struct chip8_t *chip8, uint16_t instruction) {
-  uint8_t register_x=get_4_bits(instruction, 3, 1);
-  uint8_t value=get_4_bits(instruction, 1, 2);
-  chip8->v[register_x]+=value;
-  printf("add V%d, 0x%04X\n", register_x, value);
-  increment_pc(&(chip8->pc), 1);
-}
-
-void exec_op_8(struct chip8_t *chip8, uint16_t instruction) {
-  uint8_t least_significant_4_bits=get_4_bits(instruction, 1, 1);
-  uint8_t register_x=get_4_bits(instruction, 3, 1);
-  uint8_t register_y=get_4_bits(instruction, 2, 1);
-  switch(least_significant_4_bits) {
-  case 0:
-    chip8->v[register_x]=chip8->v[register_y];
-    printf("ld V%d, V%d\n", register_x, register_y);
-    increment_pc(&(chip8->pc), 1);
-    break;
-  case 1:
-    chip8->v[register_x]|=chip8->v[register_y];
-    printf("or V%d, V%d\n", register_x, register_y);
-    increment_pc(&(chip8->pc), 1);
-    break;
-  case 2:
-    chip8->v[register_x]&=chip8->v[register_y];
-    printf("and V%d, V%d\n", register_x, register_y);
-    increment_pc(&(chip8->pc), 1);
-    break;
-  case 3:
-    chip8->v[register_x]^=chip8->v[register_y];
-    printf("xor V%d, V%d\n", register_x, register_y);
-    increment_pc(&(chip8->pc), 1);
-    break;
-  case 4: {
-    uint16_t result=chip8->v[register_x]+chip8->v[register_y];
-    chip8->v[0xF]=(result>255);
-    chip8->v[register_x]=result;
-    printf("add V%d, V%d\n", register_x, register_y);
-    increment_pc(&(chip8->pc), 1);
-    break;
+  // Uncapped frames run however many instructions the host manages, so the
+  // timer ticks could not be replayed; stepping back would fork the log.
+  if(record && (uncapped || !ipf)) {
+    fprintf(stderr, "[ERROR] --record needs a fixed --ipf\n");
+    help();
+    exit(68);
   }
-  case 5:
-    chip8->v[0xF]=(chip8->v[register_x]>chip8->v[register_y]);
-    chip8->v[register_x]-=chip8->v[register_y];
-    printf("sub V%d, V%d\n", register_x, register_y);
-    increment_pc(&(chip8->pc), 1);
-    break;
-  case 6:
-    chip8->v[0xF]=(chip8->v[register_x] & 0x1);
-    chip8->v[register_x]>>=1;
-    printf("shr V%d(%d)\n", register_x, chip8->v[register_x]);
-    increment_pc(&(chip8->pc), 1);
-    break;
-  case 7:
-    chip8->v[0xF]=(chip8->v[register_y]>chip8->v[register_x]);
-    chip8->v[register_x]=chip8->v[register_y]-chip8->v[register_x];
-    printf("subn V%d, V%d\n", register_x, register_y);
-    increment_pc(&(chip8->pc), 1);
-    break;
-  case 0xe:
-    chip8->v[0xF]=chip8->v[register_x] & (1 << 7);
-    chip8->v[register_x]<<=1;
-    printf("shl V%d\n", register_x);
-    increment_pc(&(chip8->pc), 1);
-    break;
+  if(record) rewind_mib=0;
+  if(audio_buffer > MAX_SOUND_BUFFER) {
+    fprintf(stderr, "[ERROR] --audio-buffer takes at most %d samples\n", MAX_SOUND_BUFFER);
+    help();
+    exit(68);
   }
-}
-
-void exec_op_9(struct chip8_t *chip8, uint16_t instruction) {
-  uint8_t register_x=get_4_bits(instruction, 3, 1);
-  uint8_t register_y=get_4_bits(instruction, 2, 1);
-  printf("sne V%d, V%d\n", register_x, register_y);
-  increment_pc(&(chip8->pc), (chip8->v[register_x] != chip8->v[register_y]) ? 2 : 1);
-}
-
-void exec_op_a(struct chip8_t *chip8, uint16_t instruction) {
-  uint16_t addr=get_4_bits(instruction, 1, 3);
-  chip8->i=addr;
-  printf("ld I, %d\n", addr);
-  increment_pc(&(chip8->pc), 1);
-}
-
-void exec_op_b(struct chip8_t *chip8, uint16_t instruction) {
-  uint16_t addr=get_4_bits(instruction, 1, 3);
-  increment_pc(&(chip8->pc), chip8->v[0]+addr);
-  printf("jp V0, %d\n", chip8->pc);
-}
-
-void exec_op_c(struct chip8_t *const chip8, const uint16_t instruction) {
-  const uint8_t register_x=get_4_bits(instruction, 3, 1);
-  const uint8_t value=get_4_bits(instruction, 2, 2);
-  const uint8_t random_value=GetRandomValue(0, 255);
-  chip8->v[register_x]=random_value & value;
-  increment_pc(&(chip8->pc), 1);
-  printf("rnd V%d, 0x%04X\n", register_x, random_value);
-}
-
-void exec_op_d(struct chip8_t *const chip8, const uint16_t instruction) {
-  uint8_t x_pos=chip8->v[get_4_bits(instruction, 3, 1)], original_x=x_pos;
-  uint8_t y_pos=chip8->v[get_4_bits(instruction, 2, 1)];
-  const uint8_t n_bytes=get_4_bits(instruction, 1, 1);
-  uint8_t data[n_bytes];
-  memcpy(data, chip8->ram+chip8->i, n_bytes);
-  for(int i=0; i<n_bytes; ++i) printf("%2x ", data[i]);
-  printf("\n");
-  chip8->v[0x0F]=0;
-  for(int i=0; i<n_bytes; ++i) {
-    x_pos=original_x;
-    for(int k=7; k>=0; --k) {
-      const uint8_t bit = (data[i]>>k) & 0x1;
-      uint8_t *const bit_on_screen = chip8->frame_buffer+(y_pos*(SCREEN_WIDTH)+x_pos);
-      // Or just xOr but still need to set Vf
-      if(*bit_on_screen == 1 && bit) {
-        chip8->v[0x0F]=1;
-        *bit_on_screen=0;
-      }
-      else if(bit){
-        *bit_on_screen=1;
-      }
-      x_pos+=1;
-      if(x_pos == SCREEN_WIDTH) break;
-    }
-    y_pos+=1;
-    if(y_pos == SCREEN_HEIGHT) break;
+  struct chip8_arena_t arena;
+  if(arena_init(&arena, 1)) {
+    fprintf(stderr, "[ERROR] out of memory\n");
+    exit(81);
   }
-  printf("drw %d, %d, %x\n", x_pos, y_pos, n_bytes);
-  increment_pc(&chip8->pc, 1);
-}
-
-void exec_op_e(struct chip8_t *const chip8, const uint16_t instruction) {
-  const uint8_t register_x=get_4_bits(instruction, 3, 1); 
-  const uint8_t least_significant_byte=get_4_bits(instruction, 1, 2);
-  switch(least_significant_byte) {
-    case 0x9e:
-      increment_pc(&chip8->pc, chip8->keypad[chip8->v[register_x]] ? 2 : 1);
-      printf("skp V%d\n", register_x);
-      break;
-    case 0xa1:
-      increment_pc(&chip8->pc, !chip8->keypad[chip8->v[register_x]] ? 2 : 1);
-      printf("sknp V%d\n", register_x);
-      break;
+  arena_attach(&arena, chip8);
+  struct rom_catalog_t catalog;
+  if(catalog_file && catalog_open(catalog_file, &catalog)) {
+    fprintf(stderr, "[ERROR] could not open catalog %s\n", catalog_file);
+    exit(80);
   }
-}
-
-void exec_op_f(struct chip8_t *const chip8, const uint16_t instruction) {
-  const uint8_t least_significant_byte = get_4_bits(instruction, 1, 2);
-  const uint8_t register_x = get_4_bits(instruction, 3, 1);
-  switch(least_significant_byte) {
-  case 0x07:
-    chip8->v[register_x]=chip8->dt;
-    printf("ld V%d, DT\n", register_x);
-    break;
-  case 0x0a: {
-    int8_t key_pressed=-1;
-    while((key_pressed=process_input(chip8)) != -1);
-    chip8->v[register_x]=key_pressed;
-    printf("ld V%d, %d\n", register_x, key_pressed);
-    break;
+  const ssize_t size=catalog_file ? catalog_boot(&catalog, chip8, argv[arg]) : boot(chip8, argv[arg]);
+  if(catalog_file) catalog_close(&catalog);
+  if(size < 0) {
+    fprintf(stderr, "[ERROR] could not read rom %s\n", argv[arg]);
+    exit(80);
   }
-  case 0x15:
-    chip8->dt=chip8->v[register_x];
-    printf("ld DT, V%d\n", register_x);
-    break;
-  case 0x18:
-    chip8->st=chip8->v[register_x];
-    printf("ld ST, V%d\n", register_x);
-    break;
-  case 0x1E:
-    chip8->i+=chip8->v[register_x];
-    printf("add I, V%d\n", register_x);
-    break;
-  case 0x29:
-    chip8->i=5*chip8->v[register_x];
-    printf("ld %d, V%d\n", chip8->v[register_x], register_x );
-    break;
-  case 0x33: {
-    const uint8_t bcd=chip8->v[register_x];
-    const uint8_t hundreds=(bcd/100);
-    const uint8_t tens=(bcd%100)/10;
-    const uint8_t ones=(bcd%10);
-    chip8->ram[chip8->i]=hundreds;
-    chip8->ram[chip8->i+1]=tens;
-    chip8->ram[chip8->i+2]=ones;
-    printf("ld %d, V%d\n", bcd, register_x);
-    break;
+  seed_random(chip8, seed);
+  if(has_quirks) set_quirks(chip8, quirks);
+  emulator.ipf=ipf;
+  emulator.uncapped=uncapped;
+  if(record && open_input_log(record, &emulator.log, seed, ipf, chip8->quirks)) {
+    fprintf(stderr, "[ERROR] could not write %s\n", record);
+    exit(80);
   }
-  case 0x55:
-    memcpy(chip8->ram+chip8->i, chip8->v, register_x+1);
-    printf("ld [%d], V%d\n", chip8->i, register_x);
-    break;
-  case 0x65:
-    memcpy(chip8->v, chip8->ram+chip8->i, register_x+1);
-    printf("ld V%d, [%d]\n", register_x, chip8->i);
-
-    break;
+  emulator.history=rewind_mib ? rewind_create(rewind_mib << 20, REWIND_INTERVAL) : NULL;
+  if(emulator.history) rewind_push(emulator.history, chip8);
+  triple_buffer_init(&frames);
+  init();
+  static struct beeper_t beeper;
+  AudioStream stream={ 0 };
+  if(audio_buffer) {
+    InitAudioDevice();
+    if(IsAudioDeviceReady()) {
+      // Whatever exceeds one frame and two device buffers is dropped rather
+      // than heard late.
+      sample_ring_init(&samples, SOUND_FRAME_SAMPLES+2*audio_buffer);
+      beeper_init(&beeper, &samples);
+      SetAudioStreamBufferSizeDefault(audio_buffer);
+      stream=LoadAudioStream(SOUND_RATE, 16, 1);
+      SetAudioStreamCallback(stream, play_samples);
+      PlayAudioStream(stream);
+      emulator.beeper=&beeper;
+    }
+    else fprintf(stderr, "[WARNING] no audio device, running muted\n");
   }
-  increment_pc(&chip8->pc, 1);
-}
-
-void cycle(struct chip8_t *const chip8) {
-  uint16_t instruction=(chip8->ram[(chip8->pc)]<<8)|chip8->ram[(chip8->pc)+1];
-  printf("0x%04X 0x%04X => ", chip8->pc, instruction);
-  decode_entry routines[16]={
-    exec_op_0 ,exec_op_1 ,exec_op_2 ,exec_op_3
-    ,exec_op_4 ,exec_op_5 ,exec_op_6 ,exec_op_7
-    ,exec_op_8 ,exec_op_9 ,exec_op_a ,exec_op_b
-    ,exec_op_c ,exec_op_d ,exec_op_e ,exec_op_f
-  };
-  routines[get_4_bits(instruction, 4, 1)](chip8, instruction);
-}
-
-void help() {
-  printf("Help: ./main <path_to_rom_file>.ch8\n");
-}
-
-int main(int argc, char **argv) {
-  struct chip8_t chip8;
-  if(argc != 2) {
-    fprintf(stderr, "[ERROR] no rom file was specified\n");
-    help();
-    exit(68);
+#if CHIP8_TRACE
+  trace_install_handlers();
+#endif
+  pthread_t thread;
+  if(pthread_create(&thread, NULL, emulate, &emulator)) {
+    fprintf(stderr, "[ERROR] could not start the emulation thread\n");
+    exit(81);
   }
-  boot(&chip8, argv[1]);
-  init();
-  printf("%d\n", TOTAL_PIXELS);
+  struct frame_stats_t render_stats={ 0 };
+  const double start=GetTime();
+  double window_start=start, last_frame=start;
+  uint64_t window_executed=0;
   while(!WindowShouldClose()) {
-    cycle(&chip8);
-    WaitTime(0.001667);
-    process_input(&chip8);
-    render(chip8.frame_buffer);
+    process_input();
+    atomic_store_explicit(&rewinding, IsKeyDown(REWIND_KEY), memory_order_relaxed);
+#if CHIP8_TRACE
+    if(IsKeyPressed(KEY_T)) atomic_store(&dump_requested, 1);
+#endif
+    const struct frame_t *const frame=triple_buffer_acquire(&frames);
+    if(!frame) render_stats.repeated++;
+    render(frame);
+    const double now=GetTime();
+    count_frame(&render_stats, now-last_frame);
+    last_frame=now;
+    if(uncapped && now-window_start >= 1.0) {
+      const uint64_t executed=atomic_load_explicit(&instructions, memory_order_relaxed);
+      SetWindowTitle(TextFormat("Chip-8 emulator - %.0f IPS", (executed-window_executed)/(now-window_start)));
+      window_start=now;
+      window_executed=executed;
+    }
+  }
+  atomic_store(&running, 0);
+  pthread_join(thread, NULL);
+  if(uncapped) printf("%lu instructions in %.1fs (%.0f IPS)\n", emulator.executed, GetTime()-start, emulator.executed/(GetTime()-start));
+  print_stats("emulation", &emulator.stats, "dropped before display", emulator.stats.dropped);
+  print_stats("render", &render_stats, "without a new frame", render_stats.repeated);
+  if(emulator.beeper) {
+    UnloadAudioStream(stream);
+    CloseAudioDevice();
+    printf("audio: %lu frames, %lu samples dropped, %lu samples of underrun\n", beeper.frames,
+           atomic_load(&samples.dropped), atomic_load(&samples.underruns));
   }
+  rewind_destroy(emulator.history);
+#if CHIP8_PROFILE
+  profile_report(stderr);
+  if(profile_write_flat(PROFILE_FILE)) fprintf(stderr, "[WARNING] could not write %s\n", PROFILE_FILE);
+#endif
+  if(emulator.log.file) close_input_log(&emulator.log, emulator.executed);
+  arena_free(&arena);
   return exit_();
 }
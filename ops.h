@@ -0,0 +1,449 @@
+#ifndef OPS_H
+#define OPS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "profile.h"
+
+// Semantics of every fully decoded instruction, shared by the table
+// dispatch in chip8.c and the threaded core so the two cannot drift apart.
+// Each one leaves pc pointing at the next instruction to run. Those that
+// depend on the quirk profile take its flags as arguments; every caller
+// passes constants, so each instantiation compiles down to one behaviour.
+
+void invalidate_decoded(struct chip8_t *const chip8, uint16_t addr, uint16_t size);
+
+// Every fully decoded instruction, for cores and tools that classify
+// opcodes (the threaded core's jump table, the profiler's counters).
+// KIND_LIST takes the macro to apply, for use inside another X-macro.
+#define KINDS KIND_LIST(X)
+#define KIND_LIST(X) \
+  X(0nnn) X(00e0) X(00ee) X(1nnn) X(2nnn) X(3xkk) X(4xkk) X(5xy0) \
+  X(6xkk) X(7xkk) X(8xy0) X(8xy1) X(8xy2) X(8xy3) X(8xy4) X(8xy5) \
+  X(8xy6) X(8xy7) X(8xye) X(9xy0) X(annn) X(bnnn) X(cxkk) X(dxyn) \
+  X(ex9e) X(exa1) X(fx07) X(fx0a) X(fx15) X(fx18) X(fx1e) X(fx29) \
+  X(fx33) X(fx55) X(fx65) X(unknown) \
+  X(00cn) X(00fb) X(00fc) X(00fd) X(00fe) X(00ff) X(fx30)
+
+#define X(name) KIND_##name,
+enum kind_t { KINDS KIND_COUNT };
+#undef X
+
+static inline enum kind_t kind_of(uint16_t opcode) {
+  const uint8_t n=opcode & 0xF, kk=opcode & 0xFF;
+  switch(opcode >> 12) {
+  case 0x0:
+    if((opcode & 0xFFF0) == 0x00c0) return KIND_00cn;
+    switch(opcode) {
+    case 0x00e0: return KIND_00e0;
+    case 0x00ee: return KIND_00ee;
+    case 0x00fb: return KIND_00fb;
+    case 0x00fc: return KIND_00fc;
+    case 0x00fd: return KIND_00fd;
+    case 0x00fe: return KIND_00fe;
+    case 0x00ff: return KIND_00ff;
+    default: return KIND_0nnn;
+    }
+  case 0x1: return KIND_1nnn;
+  case 0x2: return KIND_2nnn;
+  case 0x3: return KIND_3xkk;
+  case 0x4: return KIND_4xkk;
+  case 0x5: return KIND_5xy0;
+  case 0x6: return KIND_6xkk;
+  case 0x7: return KIND_7xkk;
+  case 0x8: {
+    const enum kind_t alu[16]={
+      KIND_8xy0, KIND_8xy1, KIND_8xy2, KIND_8xy3, KIND_8xy4, KIND_8xy5, KIND_8xy6, KIND_8xy7,
+      KIND_unknown, KIND_unknown, KIND_unknown, KIND_unknown, KIND_unknown, KIND_unknown, KIND_8xye, KIND_unknown
+    };
+    return alu[n];
+  }
+  case 0x9: return KIND_9xy0;
+  case 0xa: return KIND_annn;
+  case 0xb: return KIND_bnnn;
+  case 0xc: return KIND_cxkk;
+  case 0xd: return KIND_dxyn;
+  case 0xe: return kk == 0x9e ? KIND_ex9e : kk == 0xa1 ? KIND_exa1 : KIND_unknown;
+  default:
+    switch(kk) {
+    case 0x07: return KIND_fx07;
+    case 0x0a: return KIND_fx0a;
+    case 0x15: return KIND_fx15;
+    case 0x18: return KIND_fx18;
+    case 0x1e: return KIND_fx1e;
+    case 0x29: return KIND_fx29;
+    case 0x30: return KIND_fx30;
+    case 0x33: return KIND_fx33;
+    case 0x55: return KIND_fx55;
+    case 0x65: return KIND_fx65;
+    default: return KIND_unknown;
+    }
+  }
+}
+
+static inline void increment_pc(uint16_t *const pc, uint16_t increment) {
+  (*pc)+=(increment*INSTRUCTION_SIZE);
+}
+
+static inline void op_00e0(struct chip8_t *const chip8) {
+  memset(chip8->frame_buffer, 0, FRAME_BUFFER_SIZE);
+  chip8->draw=1;
+  increment_pc(&(chip8->pc), 1);
+}
+
+// SUPER-CHIP scrolling, in pixels of the current resolution. Rows move as
+// whole words and columns as shifts carried across the two halves, so a
+// scroll costs a few hundred word operations at most.
+static inline void op_00cn(struct chip8_t *const chip8, uint8_t n) {
+  const int height=screen_height(chip8), halves=chip8->hires ? 2 : 1;
+  for(int half=0; half<halves; ++half) {
+    uint64_t *const rows=chip8->frame_buffer[half];
+    memmove(rows+n, rows, (height-n)*sizeof(uint64_t));
+    memset(rows, 0, n*sizeof(uint64_t));
+  }
+  chip8->draw=1;
+  increment_pc(&(chip8->pc), 1);
+}
+
+static inline void op_00fb(struct chip8_t *const chip8) {
+  uint64_t *const left=chip8->frame_buffer[0], *const right=chip8->frame_buffer[1];
+  if(chip8->hires) {
+    for(int y=0; y<HIRES_HEIGHT; ++y) {
+      right[y]=(right[y] >> 4) | (left[y] << 60);
+      left[y]>>=4;
+    }
+  }
+  else for(int y=0; y<SCREEN_HEIGHT; ++y) left[y]>>=4;
+  chip8->draw=1;
+  increment_pc(&(chip8->pc), 1);
+}
+
+static inline void op_00fc(struct chip8_t *const chip8) {
+  uint64_t *const left=chip8->frame_buffer[0], *const right=chip8->frame_buffer[1];
+  if(chip8->hires) {
+    for(int y=0; y<HIRES_HEIGHT; ++y) {
+      left[y]=(left[y] << 4) | (right[y] >> 60);
+      right[y]<<=4;
+    }
+  }
+  else for(int y=0; y<SCREEN_HEIGHT; ++y) left[y]<<=4;
+  chip8->draw=1;
+  increment_pc(&(chip8->pc), 1);
+}
+
+// Exit: there is nothing to return to, so stay here like a jump to itself.
+static inline void op_00fd(struct chip8_t *const chip8) {
+  (void)chip8;
+}
+
+// Switching resolution clears the display, so no stale half-screen shows.
+static inline void op_00fe(struct chip8_t *const chip8) {
+  chip8->hires=0;
+  op_00e0(chip8);
+}
+
+static inline void op_00ff(struct chip8_t *const chip8) {
+  chip8->hires=1;
+  op_00e0(chip8);
+}
+
+static inline void op_00ee(struct chip8_t *const chip8) {
+  chip8->pc=chip8->stack[--chip8->sp & STACK_MASK];
+}
+
+static inline void op_0nnn(struct chip8_t *const chip8, uint16_t nnn) {
+  chip8->pc=nnn;
+}
+
+static inline void op_1nnn(struct chip8_t *const chip8, uint16_t nnn) {
+  chip8->pc=nnn;
+}
+
+static inline void op_2nnn(struct chip8_t *const chip8, uint16_t nnn) {
+  increment_pc(&(chip8->pc), 1);
+  chip8->stack[chip8->sp++ & STACK_MASK]=chip8->pc;
+  chip8->pc=nnn;
+}
+
+static inline void op_3xkk(struct chip8_t *const chip8, uint8_t x, uint8_t kk) {
+  increment_pc(&(chip8->pc), chip8->v[x] == kk ? 2 : 1);
+}
+
+static inline void op_4xkk(struct chip8_t *const chip8, uint8_t x, uint8_t kk) {
+  increment_pc(&(chip8->pc), chip8->v[x] != kk ? 2 : 1);
+}
+
+static inline void op_5xy0(struct chip8_t *const chip8, uint8_t x, uint8_t y) {
+  increment_pc(&(chip8->pc), chip8->v[x] == chip8->v[y] ? 2 : 1);
+}
+
+static inline void op_6xkk(struct chip8_t *const chip8, uint8_t x, uint8_t kk) {
+  chip8->v[x]=kk;
+  increment_pc(&(chip8->pc), 1);
+}
+
+static inline void op_7xkk(struct chip8_t *const chip8, uint8_t x, uint8_t kk) {
+  chip8->v[x]+=kk;
+  increment_pc(&(chip8->pc), 1);
+}
+
+static inline void op_8xy0(struct chip8_t *const chip8, uint8_t x, uint8_t y) {
+  chip8->v[x]=chip8->v[y];
+  increment_pc(&(chip8->pc), 1);
+}
+
+static inline void op_8xy1(struct chip8_t *const chip8, uint8_t x, uint8_t y) {
+  chip8->v[x]|=chip8->v[y];
+  increment_pc(&(chip8->pc), 1);
+}
+
+static inline void op_8xy2(struct chip8_t *const chip8, uint8_t x, uint8_t y) {
+  chip8->v[x]&=chip8->v[y];
+  increment_pc(&(chip8->pc), 1);
+}
+
+static inline void op_8xy3(struct chip8_t *const chip8, uint8_t x, uint8_t y) {
+  chip8->v[x]^=chip8->v[y];
+  increment_pc(&(chip8->pc), 1);
+}
+
+static inline void op_8xy4(struct chip8_t *const chip8, uint8_t x, uint8_t y) {
+  uint16_t result=chip8->v[x]+chip8->v[y];
+  chip8->v[0xF]=(result>255);
+  chip8->v[x]=result;
+  increment_pc(&(chip8->pc), 1);
+}
+
+static inline void op_8xy5(struct chip8_t *const chip8, uint8_t x, uint8_t y) {
+  chip8->v[0xF]=(chip8->v[x]>chip8->v[y]);
+  chip8->v[x]-=chip8->v[y];
+  increment_pc(&(chip8->pc), 1);
+}
+
+// Without shift_vx Vy is the source, and VF is written last so it wins
+// over x == F.
+static inline void op_8xy6(struct chip8_t *const chip8, uint8_t x, uint8_t y, const int shift_vx) {
+  if(shift_vx) {
+    chip8->v[0xF]=(chip8->v[x] & 0x1);
+    chip8->v[x]>>=1;
+  }
+  else {
+    const uint8_t flag=chip8->v[y] & 0x1;
+    chip8->v[x]=chip8->v[y] >> 1;
+    chip8->v[0xF]=flag;
+  }
+  increment_pc(&(chip8->pc), 1);
+}
+
+static inline void op_8xy7(struct chip8_t *const chip8, uint8_t x, uint8_t y) {
+  chip8->v[0xF]=(chip8->v[y]>chip8->v[x]);
+  chip8->v[x]=chip8->v[y]-chip8->v[x];
+  increment_pc(&(chip8->pc), 1);
+}
+
+static inline void op_8xye(struct chip8_t *const chip8, uint8_t x, uint8_t y, const int shift_vx) {
+  if(shift_vx) {
+    chip8->v[0xF]=chip8->v[x] >> 7;
+    chip8->v[x]<<=1;
+  }
+  else {
+    const uint8_t flag=chip8->v[y] >> 7;
+    chip8->v[x]=chip8->v[y] << 1;
+    chip8->v[0xF]=flag;
+  }
+  increment_pc(&(chip8->pc), 1);
+}
+
+static inline void op_9xy0(struct chip8_t *const chip8, uint8_t x, uint8_t y) {
+  increment_pc(&(chip8->pc), chip8->v[x] != chip8->v[y] ? 2 : 1);
+}
+
+static inline void op_annn(struct chip8_t *const chip8, uint16_t nnn) {
+  chip8->i=nnn;
+  increment_pc(&(chip8->pc), 1);
+}
+
+static inline void op_bnnn(struct chip8_t *const chip8, uint16_t nnn, const int jump_vx) {
+  chip8->pc=chip8->v[jump_vx ? nnn >> 8 : 0]+nnn;
+}
+
+// xoshiro128**: four words of state, a handful of ALU ops per draw.
+static inline uint32_t next_random(struct chip8_t *const chip8) {
+  uint32_t *const s=chip8->rng;
+  const uint32_t rotated=s[1]*5;
+  const uint32_t result=((rotated << 7) | (rotated >> 25))*9;
+  const uint32_t t=s[1] << 9;
+  s[2]^=s[0];
+  s[3]^=s[1];
+  s[1]^=s[2];
+  s[0]^=s[3];
+  s[2]^=t;
+  s[3]=(s[3] << 11) | (s[3] >> 21);
+  return result;
+}
+
+static inline uint8_t op_cxkk(struct chip8_t *const chip8, uint8_t x, uint8_t kk) {
+  // The high bits are the better ones.
+  const uint8_t random_value=next_random(chip8) >> 24;
+  chip8->v[x]=random_value & kk;
+  increment_pc(&(chip8->pc), 1);
+  return random_value;
+}
+
+// Places a 16 pixel wide sprite row starting at column x_pos (0-127) of a
+// 128 pixel row: its left and right words.
+static inline void sprite_words(uint16_t bits, uint8_t x_pos, uint64_t *const left, uint64_t *const right) {
+  *left=x_pos <= 48 ? (uint64_t)bits << (48-x_pos) : x_pos < 64 ? (uint64_t)bits >> (x_pos-48) : 0;
+  *right=x_pos <= 48 ? 0 : x_pos <= 112 ? (uint64_t)bits << (112-x_pos) : (uint64_t)bits >> (x_pos-112);
+}
+
+// Dxyn in high resolution, and Dxy0 in either: 8 pixel wide rows, or 16x16
+// for Dxy0 with two bytes per row. Same wrapping and clipping as below,
+// and VF is still a plain collision flag.
+static inline void op_dxyn_wide(struct chip8_t *const chip8, uint8_t x, uint8_t y, uint8_t n, const int wrap) {
+  const int width=screen_width(chip8), height=screen_height(chip8);
+  const uint8_t x_pos=chip8->v[x] & (width-1);
+  const uint8_t y_pos=chip8->v[y] & (height-1);
+  const uint8_t count=n ? n : 16;
+  const uint8_t rows=(!wrap && y_pos+count > height) ? height-y_pos : count;
+  uint64_t collision=0;
+  for(uint8_t row=0; row<rows; ++row) {
+    const uint16_t at=chip8->i+(n ? row : 2*row);
+    const uint16_t bits=n ? chip8->ram[at & RAM_MASK] << 8 : (chip8->ram[at & RAM_MASK] << 8) | chip8->ram[(at+1) & RAM_MASK];
+    uint64_t left, right;
+    sprite_words(bits, x_pos, &left, &right);
+    // Low resolution has no right half; what lands there is clipped, or
+    // wraps to where the same bits sit in the left word.
+    if(!chip8->hires) {
+      if(wrap) left|=right;
+      right=0;
+    }
+    else if(wrap && x_pos > HIRES_WIDTH-16) left|=(uint64_t)bits << (HIRES_WIDTH+48-x_pos);
+    const uint8_t line=wrap ? (y_pos+row) & (height-1) : y_pos+row;
+    uint64_t *const line_left=chip8->frame_buffer[0]+line, *const line_right=chip8->frame_buffer[1]+line;
+    profile_sprite_row(left, *line_left & left);
+    profile_sprite_row(right, *line_right & right);
+    collision|=(*line_left & left) | (*line_right & right);
+    *line_left^=left;
+    *line_right^=right;
+  }
+  profile_sprite(rows);
+  chip8->v[0x0F]=(collision != 0);
+  chip8->draw=1;
+  increment_pc(&chip8->pc, 1);
+}
+
+// Sprites start at (Vx mod 64, Vy mod 32) and are clipped at the right and
+// bottom edges, or with wrap continue on the opposite ones. Each sprite row
+// is one shift (a rotate when wrapping) and one XOR into the row word.
+static inline void op_dxyn(struct chip8_t *const chip8, uint8_t x, uint8_t y, uint8_t n, const int wrap) {
+  if(chip8->hires || !n) {
+    op_dxyn_wide(chip8, x, y, n, wrap);
+    return;
+  }
+  const uint8_t x_pos=chip8->v[x] % SCREEN_WIDTH;
+  const uint8_t y_pos=chip8->v[y] % SCREEN_HEIGHT;
+  const uint8_t rows=(!wrap && y_pos+n > SCREEN_HEIGHT) ? SCREEN_HEIGHT-y_pos : n;
+  uint64_t collision=0;
+  for(uint8_t row=0; row<rows; ++row) {
+    const uint64_t bits=(uint64_t)chip8->ram[(chip8->i+row) & RAM_MASK] << (SCREEN_WIDTH-8);
+    const uint64_t sprite=wrap ? (bits >> x_pos) | (bits << ((SCREEN_WIDTH-x_pos) & 63)) : bits >> x_pos;
+    uint64_t *const line=chip8->frame_buffer[0]+(wrap ? (y_pos+row) % SCREEN_HEIGHT : y_pos+row);
+    profile_sprite_row(sprite, *line & sprite);
+    collision|=*line & sprite;
+    *line^=sprite;
+  }
+  profile_sprite(rows);
+  chip8->v[0x0F]=(collision != 0);
+  chip8->draw=1;
+  increment_pc(&chip8->pc, 1);
+}
+
+static inline void op_ex9e(struct chip8_t *const chip8, uint8_t x) {
+  increment_pc(&chip8->pc, (chip8->keys >> (chip8->v[x] & 0xF)) & 1 ? 2 : 1);
+}
+
+static inline void op_exa1(struct chip8_t *const chip8, uint8_t x) {
+  increment_pc(&chip8->pc, (chip8->keys >> (chip8->v[x] & 0xF)) & 1 ? 1 : 2);
+}
+
+static inline void op_fx07(struct chip8_t *const chip8, uint8_t x) {
+  chip8->v[x]=chip8->dt;
+  increment_pc(&chip8->pc, 1);
+}
+
+// The frontend refreshes the keypad between frames, so stay on this
+// instruction and flag it until a key is down; the lowest one wins.
+static inline void op_fx0a(struct chip8_t *const chip8, uint8_t x) {
+  chip8->waiting=!chip8->keys;
+  if(chip8->waiting) return;
+  chip8->v[x]=__builtin_ctz(chip8->keys);
+  increment_pc(&chip8->pc, 1);
+}
+
+static inline void op_fx15(struct chip8_t *const chip8, uint8_t x) {
+  chip8->dt=chip8->v[x];
+  increment_pc(&chip8->pc, 1);
+}
+
+static inline void op_fx18(struct chip8_t *const chip8, uint8_t x) {
+  chip8->st=chip8->v[x];
+  increment_pc(&chip8->pc, 1);
+}
+
+static inline void op_fx1e(struct chip8_t *const chip8, uint8_t x) {
+  chip8->i+=chip8->v[x];
+  increment_pc(&chip8->pc, 1);
+}
+
+static inline void op_fx29(struct chip8_t *const chip8, uint8_t x) {
+  chip8->i=5*chip8->v[x];
+  increment_pc(&chip8->pc, 1);
+}
+
+static inline void op_fx30(struct chip8_t *const chip8, uint8_t x) {
+  chip8->i=BIG_FONT+10*(chip8->v[x] & 0xF);
+  increment_pc(&chip8->pc, 1);
+}
+
+// I can grow past the end of ram through Fx1E, so the memory instructions
+// wrap it like every other address.
+static inline void op_fx33(struct chip8_t *const chip8, uint8_t x) {
+  const uint8_t bcd=chip8->v[x];
+  uint8_t *const ram=chip8->ram;
+  const uint16_t i=chip8->i;
+  ram[i & RAM_MASK]=(bcd/100);
+  ram[(i+1) & RAM_MASK]=(bcd%100)/10;
+  ram[(i+2) & RAM_MASK]=(bcd%10);
+  invalidate_decoded(chip8, chip8->i, 3);
+  increment_pc(&chip8->pc, 1);
+}
+
+static inline void op_fx55(struct chip8_t *const chip8, uint8_t x, const int keep_i) {
+  // Byte stores may alias *chip8; keep ram and i out of the loop.
+  uint8_t *const ram=chip8->ram;
+  const uint16_t i=chip8->i;
+  for(uint8_t r=0; r<=x; ++r) ram[(i+r) & RAM_MASK]=chip8->v[r];
+  invalidate_decoded(chip8, chip8->i, x+1);
+  if(!keep_i) chip8->i+=x+1;
+  increment_pc(&chip8->pc, 1);
+}
+
+static inline void op_fx65(struct chip8_t *const chip8, uint8_t x, const int keep_i) {
+  const uint8_t *const ram=chip8->ram;
+  const uint16_t i=chip8->i;
+  for(uint8_t r=0; r<=x; ++r) chip8->v[r]=ram[(i+r) & RAM_MASK];
+  if(!keep_i) chip8->i+=x+1;
+  increment_pc(&chip8->pc, 1);
+}
+
+// Unassigned 8xyN and ExNN encodings leave pc alone, unassigned FxNN ones
+// move on, as the interpreter always did.
+static inline void op_unknown(struct chip8_t *const chip8, uint16_t opcode) {
+  if((opcode >> 12) == 0xf) increment_pc(&chip8->pc, 1);
+}
+
+#endif
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "ops.h"
+#include "profile.h"
+
+#if CHIP8_PROFILE
+
+_Static_assert(KIND_COUNT <= 64, "one profile slot per opcode kind");
+
+struct profile_t profile;
+
+#define X(name) #name,
+static const char *const kind_names[]={ KINDS };
+#undef X
+
+void profile_count(uint16_t pc, uint16_t opcode, uint64_t ticks) {
+  const enum kind_t kind=kind_of(opcode);
+  profile.kind_count[kind]++;
+  profile.kind_ticks[kind]+=ticks;
+  profile.pc_count[pc & RAM_MASK]++;
+  profile.pc_ticks[pc & RAM_MASK]+=ticks;
+}
+
+static int by_kind_ticks(const void *a, const void *b) {
+  const uint64_t x=profile.kind_ticks[*(const int *)a], y=profile.kind_ticks[*(const int *)b];
+  return (x < y)-(x > y);
+}
+
+static int by_pc_count(const void *a, const void *b) {
+  const uint64_t x=profile.pc_count[*(const uint16_t *)a], y=profile.pc_count[*(const uint16_t *)b];
+  return (x < y)-(x > y);
+}
+
+void profile_report(FILE *const out) {
+  uint64_t total=0, total_ticks=0;
+  int kinds[KIND_COUNT];
+  for(int kind=0; kind<KIND_COUNT; ++kind) {
+    kinds[kind]=kind;
+    total+=profile.kind_count[kind];
+    total_ticks+=profile.kind_ticks[kind];
+  }
+  if(!total) return;
+  qsort(kinds, KIND_COUNT, sizeof(kinds[0]), by_kind_ticks);
+  fprintf(out, "%-8s %14s %7s %16s %7s %10s\n", "kind", "count", "count%", "ticks", "ticks%", "ticks/op");
+  for(int k=0; k<KIND_COUNT; ++k) {
+    const int kind=kinds[k];
+    const uint64_t count=profile.kind_count[kind], ticks=profile.kind_ticks[kind];
+    if(!count) break;
+    fprintf(out, "%-8s %14lu %6.2f%% %16lu %6.2f%% %10.1f\n", kind_names[kind], count, 100.0*count/total,
+            ticks, total_ticks ? 100.0*ticks/total_ticks : 0, (double)ticks/count);
+  }
+
+  uint16_t pcs[1<<12];
+  for(int pc=0; pc<(1<<12); ++pc) pcs[pc]=pc;
+  qsort(pcs, 1<<12, sizeof(pcs[0]), by_pc_count);
+  fprintf(out, "\n%-6s %14s %7s %10s\n", "pc", "count", "count%", "ticks/op");
+  for(int p=0; p<PROFILE_TOP_PCS && profile.pc_count[pcs[p]]; ++p) {
+    const uint16_t pc=pcs[p];
+    fprintf(out, "0x%03X  %14lu %6.2f%% %10.1f\n", pc, profile.pc_count[pc],
+            100.0*profile.pc_count[pc]/total, (double)profile.pc_ticks[pc]/profile.pc_count[pc]);
+  }
+
+  if(profile.sprites)
+    fprintf(out, "\ndxyn: %lu sprites, %lu rows, %lu pixels drawn (%.1f per sprite), %lu erased\n",
+            profile.sprites, profile.sprite_rows, profile.sprite_pixels,
+            (double)profile.sprite_pixels/profile.sprites, profile.erased_pixels);
+}
+
+int profile_write_flat(const char *const file_name) {
+  FILE *const file=fopen(file_name, "w");
+  if(!file) return -1;
+  fprintf(file, "# addr count ticks\n");
+  for(int pc=0; pc<(1<<12); ++pc) fprintf(file, "0x%03X %lu %lu\n", pc, profile.pc_count[pc], profile.pc_ticks[pc]);
+  return fclose(file) ? -1 : 0;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Execution profile, picked at build time (make profile=1) like tracing:
+// at 0 every hook below compiles to nothing. At 1 cycle() counts each
+// instruction per opcode kind and per address along with the time stamp
+// counter ticks it took, and Dxyn counts the pixels it draws. The threaded
+// core runs through cycle() then and the dynarec and SIMD lanes are off, so
+// every instruction is seen. Counters are plain globals: profile one
+// instance on one thread.
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 0
+#endif
+
+#define PROFILE_FILE "chip8-profile.txt"
+#define PROFILE_TOP_PCS 16
+
+#if CHIP8_PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t profile_clock() {
+  return __rdtsc();
+}
+#else
+#include <time.h>
+static inline uint64_t profile_clock() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec*1000000000ull+now.tv_nsec;
+}
+#endif
+
+struct profile_t {
+  uint64_t kind_count[64], kind_ticks[64]; // indexed by enum kind_t
+  uint64_t pc_count[1<<12], pc_ticks[1<<12];
+  uint64_t sprites, sprite_rows, sprite_pixels, erased_pixels;
+};
+
+extern struct profile_t profile;
+
+#define profile_sprite_row(sprite, hit) \
+  do { \
+    profile.sprite_pixels+=__builtin_popcountll(sprite); \
+    profile.erased_pixels+=__builtin_popcountll(hit); \
+  } while(0)
+#define profile_sprite(rows) \
+  do { \
+    profile.sprites++; \
+    profile.sprite_rows+=(rows); \
+  } while(0)
+
+// Called by cycle() after each instruction.
+void profile_count(uint16_t pc, uint16_t opcode, uint64_t ticks);
+// Kinds sorted by ticks, the busiest addresses and the Dxyn totals.
+void profile_report(FILE *const out);
+// One "<addr> <count> <ticks>" line for each of the 4096 addresses in
+// order, so a script can reshape it into a 64x64 heatmap.
+int profile_write_flat(const char *const file_name);
+#else
+#define profile_sprite_row(sprite, hit) ((void)0)
+#define profile_sprite(rows) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "rewind.h"
+
+// Zero runs shorter than this stay inside a literal run.
+#define MIN_ZERO_RUN 4
+#define RAM_CHUNK 64
+
+struct run_header_t {
+  uint16_t skip, length;
+};
+
+static void capture(const struct chip8_t *const chip8, struct rewind_frame_t *const frame) {
+  // Padding must compare equal between captures.
+  memset(frame, 0, sizeof(*frame));
+  memcpy(frame->ram, chip8->ram, sizeof(frame->ram));
+  memcpy(frame->frame_buffer, chip8->frame_buffer, sizeof(frame->frame_buffer));
+  memcpy(frame->stack, chip8->stack, sizeof(frame->stack));
+  memcpy(frame->rng, chip8->rng, sizeof(frame->rng));
+  memcpy(frame->v, chip8->v, sizeof(frame->v));
+  frame->i=chip8->i;
+  frame->pc=chip8->pc;
+  frame->sp=chip8->sp;
+  frame->dt=chip8->dt;
+  frame->st=chip8->st;
+  frame->hires=chip8->hires;
+}
+
+static void restore(const struct rewind_frame_t *const frame, struct chip8_t *const chip8) {
+  // Only rewritten ram drops decoded instructions.
+  for(size_t at=0; at<sizeof(frame->ram); at+=RAM_CHUNK) {
+    if(!memcmp(chip8->ram+at, frame->ram+at, RAM_CHUNK)) continue;
+    memcpy(chip8->ram+at, frame->ram+at, RAM_CHUNK);
+    invalidate_decoded(chip8, at, RAM_CHUNK);
+  }
+  memcpy(chip8->frame_buffer, frame->frame_buffer, sizeof(frame->frame_buffer));
+  memcpy(chip8->stack, frame->stack, sizeof(frame->stack));
+  memcpy(chip8->rng, frame->rng, sizeof(frame->rng));
+  memcpy(chip8->v, frame->v, sizeof(frame->v));
+  chip8->i=frame->i;
+  chip8->pc=frame->pc;
+  chip8->sp=frame->sp;
+  chip8->dt=frame->dt;
+  chip8->st=frame->st;
+  chip8->hires=frame->hires;
+  chip8->draw=1;
+  chip8->waiting=0;
+}
+
+// XORs `frame` against `key` into runs of {zero bytes to skip, literal
+// bytes that follow}. Returns the encoded size.
+static size_t encode_delta(const struct rewind_frame_t *const frame, const struct rewind_frame_t *const key, uint8_t *const out) {
+  const uint8_t *const a=(const uint8_t *)frame, *const b=(const uint8_t *)key;
+  const size_t size=sizeof(*frame);
+  size_t at=0, written=0;
+  while(at < size) {
+    const size_t start=at;
+    while(at < size && a[at] == b[at]) ++at;
+    if(at == size) break;
+    const size_t literal=at;
+    while(at < size) {
+      size_t zeroes=at;
+      while(zeroes < size && a[zeroes] == b[zeroes] && zeroes-at < MIN_ZERO_RUN) ++zeroes;
+      if(zeroes == at) ++at;
+      else if(zeroes-at >= MIN_ZERO_RUN || zeroes == size) break;
+      else at=zeroes;
+    }
+    const struct run_header_t header={ .skip=literal-start, .length=at-literal };
+    memcpy(out+written, &header, sizeof(header));
+    written+=sizeof(header);
+    for(size_t k=literal; k<at; ++k) out[written++]=a[k]^b[k];
+  }
+  return written;
+}
+
+static void apply_delta(const uint8_t *const data, size_t size, struct rewind_frame_t *const frame) {
+  uint8_t *const bytes=(uint8_t *)frame;
+  size_t at=0, read=0;
+  while(read < size) {
+    struct run_header_t header;
+    memcpy(&header, data+read, sizeof(header));
+    read+=sizeof(header);
+    at+=header.skip;
+    for(size_t k=0; k<header.length; ++k) bytes[at++]^=data[read++];
+  }
+}
+
+static struct rewind_entry_t *entry(struct rewind_t *const rewind, size_t index) {
+  return rewind->entries+(rewind->first+index) % rewind->capacity;
+}
+
+static void drop_oldest(struct rewind_t *const rewind) {
+  struct rewind_entry_t *const oldest=entry(rewind, 0);
+  rewind->used-=oldest->size;
+  free(oldest->data);
+  rewind->first=(rewind->first+1) % rewind->capacity;
+  rewind->count--;
+}
+
+static int grow(struct rewind_t *const rewind) {
+  const size_t capacity=rewind->capacity*2;
+  struct rewind_entry_t *const entries=malloc(capacity*sizeof(struct rewind_entry_t));
+  if(!entries) return -1;
+  for(size_t index=0; index<rewind->count; ++index) entries[index]=*entry(rewind, index);
+  free(rewind->entries);
+  rewind->entries=entries;
+  rewind->capacity=capacity;
+  rewind->first=0;
+  return 0;
+}
+
+struct rewind_t *rewind_create(size_t budget, uint32_t interval) {
+  struct rewind_t *const rewind=calloc(1, sizeof(struct rewind_t));
+  if(!rewind) return NULL;
+  rewind->capacity=1024;
+  rewind->entries=malloc(rewind->capacity*sizeof(struct rewind_entry_t));
+  if(!rewind->entries) {
+    free(rewind);
+    return NULL;
+  }
+  rewind->budget=budget;
+  rewind->interval=interval ? interval : 1;
+  return rewind;
+}
+
+void rewind_destroy(struct rewind_t *const rewind) {
+  if(!rewind) return;
+  while(rewind->count) drop_oldest(rewind);
+  free(rewind->entries);
+  free(rewind);
+}
+
+int rewind_push(struct rewind_t *const rewind, const struct chip8_t *const chip8) {
+  struct rewind_frame_t frame;
+  capture(chip8, &frame);
+  const struct rewind_entry_t *const newest=rewind->count ? entry(rewind, rewind->count-1) : NULL;
+  uint32_t key=newest && newest->key+1 < rewind->interval ? newest->key+1 : 0;
+  size_t size=key ? encode_delta(&frame, &rewind->key, rewind->scratch) : sizeof(frame);
+  // A delta is useless without its keyframe, so the oldest keyframe goes
+  // together with everything up to the next one.
+  while(rewind->count && rewind->used+size > rewind->budget) {
+    drop_oldest(rewind);
+    while(rewind->count && entry(rewind, 0)->key) drop_oldest(rewind);
+  }
+  if(!rewind->count) {
+    key=0;
+    size=sizeof(frame);
+  }
+  // Copies go through memcpy so the zeroed padding survives.
+  if(!key) memcpy(&rewind->key, &frame, sizeof(frame));
+  if(rewind->count == rewind->capacity && grow(rewind)) return -1;
+  struct rewind_entry_t *const slot=entry(rewind, rewind->count);
+  slot->data=malloc(size ? size : 1);
+  if(!slot->data) return -1;
+  memcpy(slot->data, key ? (const void *)rewind->scratch : (const void *)&frame, size);
+  slot->size=size;
+  slot->key=key;
+  rewind->used+=size;
+  rewind->count++;
+  return 0;
+}
+
+int rewind_pop(struct rewind_t *const rewind, struct chip8_t *const chip8) {
+  if(rewind->count < 2) return -1;
+  struct rewind_entry_t *const newest=entry(rewind, rewind->count-1);
+  rewind->used-=newest->size;
+  free(newest->data);
+  rewind->count--;
+
+  const struct rewind_entry_t *const target=entry(rewind, rewind->count-1);
+  const struct rewind_entry_t *const keyframe=entry(rewind, rewind->count-1-target->key);
+  memcpy(&rewind->key, keyframe->data, sizeof(rewind->key));
+  struct rewind_frame_t frame;
+  memcpy(&frame, &rewind->key, sizeof(frame));
+  if(target->key) apply_delta(target->data, target->size, &frame);
+  restore(&frame, chip8);
+  return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// History of the machine, one entry per frame, for stepping backwards.
+// Every `interval` frames the whole state is stored as a keyframe; the
+// frames in between only store the XOR of their state against that
+// keyframe, run-length encoding the zero bytes, which is most of them.
+// Restoring any frame decodes one keyframe and one delta. Once `budget`
+// bytes are used the oldest keyframe goes, along with its deltas.
+
+#define REWIND_INTERVAL TIMER_HZ
+#define DEFAULT_REWIND_MIB 16
+
+// The part of struct chip8_t that a rewind restores. The keypad follows the
+// live keyboard instead.
+struct rewind_frame_t {
+  uint8_t ram[1<<12];
+  uint64_t frame_buffer[2][HIRES_HEIGHT];
+  uint16_t stack[16];
+  uint32_t rng[4];
+  uint8_t v[16];
+  uint16_t i, pc;
+  uint8_t sp, dt, st, hires;
+};
+
+struct rewind_entry_t {
+  uint8_t *data;
+  uint32_t size;
+  uint32_t key; // entries back to its keyframe, 0 for a keyframe
+};
+
+struct rewind_t {
+  struct rewind_entry_t *entries; // circular, oldest at `first`
+  size_t capacity, first, count;
+  size_t used, budget; // bytes
+  uint32_t interval;
+  struct rewind_frame_t key; // keyframe the newest entry refers to
+  // Runs are split at 4 or more zero bytes, so the 4-byte run headers can
+  // at most double the size.
+  uint8_t scratch[2*sizeof(struct rewind_frame_t)];
+};
+
+struct rewind_t *rewind_create(size_t budget, uint32_t interval);
+void rewind_destroy(struct rewind_t *const rewind);
+// Records the state at the end of a frame. Returns -1 when out of memory.
+int rewind_push(struct rewind_t *const rewind, const struct chip8_t *const chip8);
+// Drops the newest frame and restores the one before it into chip8.
+// Returns -1, leaving chip8 alone, when there is no older frame.
+int rewind_pop(struct rewind_t *const rewind, struct chip8_t *const chip8);
+
+#endif
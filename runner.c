@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "aot.h"
+#include "chip8.h"
+#include "dynarec.h"
+#include "input.h"
+#include "runner.h"
+#include "simd.h"
+#include "sound.h"
+#include "threaded.h"
+
+int parse_core(const char *const name, enum core_t *const core) {
+  const char *const names[]={ "interpreter", "threaded", "dynarec", "lockstep" };
+  for(size_t c=0; c<sizeof(names)/sizeof(names[0]); ++c) {
+    if(!strcmp(name, names[c])) {
+      *core=c;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+const char *exit_reason_name(enum exit_reason_t reason) {
+  switch(reason) {
+  case EXIT_CYCLES: return "cycles";
+  case EXIT_HALTED: return "halted";
+  case EXIT_WAITING: return "waiting";
+  }
+  return "?";
+}
+
+void run_core(const struct run_t *const config, struct chip8_t *const chip8, uint64_t cycles) {
+  switch(config->core) {
+  case CORE_THREADED:
+    run_threaded(chip8, cycles);
+    break;
+  case CORE_DYNAREC:
+    dynarec_run(config->dynarec, chip8, cycles);
+    break;
+  case CORE_AOT:
+    aot_run(config->aot, chip8, cycles);
+    break;
+  default:
+    run_cycles(chip8, cycles);
+    break;
+  }
+}
+
+static enum exit_reason_t idle_reason(const struct chip8_t *const chip8, uint64_t next_event) {
+  if(next_event != UINT64_MAX) return EXIT_CYCLES;
+  const uint16_t opcode=fetch(chip8, chip8->pc);
+  if((opcode == (0x1000|chip8->pc) || opcode == 0x00FD) && !chip8->dt && !chip8->st) return EXIT_HALTED;
+  if((opcode & 0xF0FF) == 0xF00A && !chip8->keys) return EXIT_WAITING;
+  return EXIT_CYCLES;
+}
+
+static uint64_t slice(const struct run_t *const config, uint64_t done, uint64_t frame, uint64_t cycles, uint64_t next_event) {
+  uint64_t step=cycles-done;
+  if(config->ipf && step > config->ipf-frame) step=config->ipf-frame;
+  if(step > next_event-done) step=next_event-done;
+  return step;
+}
+
+// Idle loops are looked for at the start of every slice and this often
+// inside one, so a ROM that starts waiting partway through a long frame
+// still has the rest of it skipped.
+#define IDLE_CHECK_INTERVAL 1024
+
+// run_core() skipping idle loops. A slice ends at every timer tick and
+// keypad change, so its memo is only as old as dt and the keys.
+static void run_skipping(const struct run_t *const config, struct chip8_t *const chip8, uint64_t step) {
+  struct idle_memo_t memo={ 0 };
+  while(step) {
+    step-=idle_skip(chip8, step, &memo);
+    const uint64_t chunk=step < IDLE_CHECK_INTERVAL ? step : IDLE_CHECK_INTERVAL;
+    run_core(config, chip8, chunk);
+    step-=chunk;
+  }
+}
+
+static void run_beeping(const struct run_t *const config, struct chip8_t *const chip8, uint64_t step, uint64_t frame) {
+  struct beeper_t *const beeper=config->beeper;
+  for(uint64_t done=1; done<=step; ++done) {
+    run_core(config, chip8, 1);
+    if((chip8->st != 0) != beeper->on) beeper_set(beeper, (frame+done)*SOUND_FRAME_SAMPLES/config->ipf, chip8->st != 0);
+  }
+}
+
+enum exit_reason_t run(const struct run_t *const config, struct chip8_t *const chip8, uint64_t cycles, uint64_t *const executed) {
+  uint64_t done=0, frame=0;
+  enum exit_reason_t reason=EXIT_CYCLES;
+  while(done < cycles) {
+    const uint64_t next_event=config->input ? apply_input(config->input, chip8, done) : UINT64_MAX;
+    if(config->stop_when_idle && (reason=idle_reason(chip8, next_event)) != EXIT_CYCLES) break;
+    const uint64_t step=slice(config, done, frame, cycles, next_event);
+    if(config->beeper) run_beeping(config, chip8, step, frame);
+    else if(config->skip_idle) run_skipping(config, chip8, step);
+    else run_core(config, chip8, step);
+    done+=step;
+    frame+=step;
+    if(config->ipf && frame == config->ipf) {
+      if(config->beeper) beeper_end_frame(config->beeper);
+      tick_timers(chip8);
+      if(config->beeper) beeper_set(config->beeper, 0, chip8->st != 0);
+      frame=0;
+    }
+  }
+  *executed=done;
+  return reason;
+}
+
+void run_lanes(const struct run_t *const config, struct chip8_lanes_t *const lanes, struct input_script_t *const input[], const uint64_t cycles[], uint64_t executed[], enum exit_reason_t reasons[]) {
+  uint64_t frame[LANES]={ 0 };
+  int running=lanes->count;
+  for(int l=0; l<lanes->count; ++l) {
+    executed[l]=0;
+    reasons[l]=EXIT_CYCLES;
+  }
+  while(running) {
+    uint16_t budget[LANES]={ 0 };
+    running=0;
+    for(int l=0; l<lanes->count; ++l) {
+      struct chip8_t *const chip8=lanes->lane[l];
+      if(reasons[l] != EXIT_CYCLES || executed[l] == cycles[l]) continue;
+      lanes_store_pc(lanes, l);
+      const uint64_t next_event=input[l] ? apply_input(input[l], chip8, executed[l]) : UINT64_MAX;
+      if(config->stop_when_idle && (reasons[l]=idle_reason(chip8, next_event)) != EXIT_CYCLES) continue;
+      const uint64_t step=slice(config, executed[l], frame[l], cycles[l], next_event);
+      budget[l]=step > UINT16_MAX ? UINT16_MAX : step;
+      running=1;
+    }
+    lanes_run(lanes, budget);
+    for(int l=0; l<lanes->count; ++l) {
+      executed[l]+=budget[l];
+      frame[l]+=budget[l];
+      if(config->ipf && frame[l] == config->ipf) {
+        lanes_tick_timers(lanes, l);
+        frame[l]=0;
+      }
+    }
+  }
+  lanes_store(lanes);
+}
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec+ts.tv_nsec*1e-9;
+}
@@ -0,0 +1,50 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include <stdint.h>
+
+#include "aot.h"
+#include "chip8.h"
+#include "dynarec.h"
+#include "input.h"
+#include "simd.h"
+#include "sound.h"
+
+// Shared driver for the display-less frontends (chip8-headless,
+// chip8-batch): picks a core, slices the run into 60 Hz frames for the
+// timers and feeds scripted input at exact cycles.
+
+// CORE_AOT has no name for parse_core(); it is picked by loading an image.
+enum core_t { CORE_INTERPRETER, CORE_THREADED, CORE_DYNAREC, CORE_LOCKSTEP, CORE_AOT };
+
+enum exit_reason_t { EXIT_CYCLES, EXIT_HALTED, EXIT_WAITING };
+
+struct run_t {
+  enum core_t core;
+  struct dynarec_t *dynarec; // required by CORE_DYNAREC
+  struct aot_t *aot; // required by CORE_AOT, attached to the instance
+  uint64_t ipf; // instructions per timer tick, 0 never ticks
+  struct input_script_t *input; // optional
+  // Stop early once nothing observable can change any more: a jump to
+  // itself (or 00FD) with both timers at zero, or Fx0A with no keys left
+  // to come.
+  int stop_when_idle;
+  // Optional, needs ipf. Cores then run one instruction at a time so the
+  // beeper hears where in the frame st changes.
+  struct beeper_t *beeper;
+  // Skip whole passes of idle loops (see idle_loop()) instead of running
+  // them. The results are the same; only the time spent differs.
+  int skip_idle;
+};
+
+int parse_core(const char *const name, enum core_t *const core);
+const char *exit_reason_name(enum exit_reason_t reason);
+// CORE_LOCKSTEP is not handled here, it needs a reference instance.
+void run_core(const struct run_t *const config, struct chip8_t *const chip8, uint64_t cycles);
+enum exit_reason_t run(const struct run_t *const config, struct chip8_t *const chip8, uint64_t cycles, uint64_t *const executed);
+// Runs every lane of `lanes` as run() would with its own cycles and input
+// script. config->core, config->input and config->beeper are ignored.
+void run_lanes(const struct run_t *const config, struct chip8_lanes_t *const lanes, struct input_script_t *const input[], const uint64_t cycles[], uint64_t executed[], enum exit_reason_t reasons[]);
+double now();
+
+#endif
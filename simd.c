@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "ops.h"
+#include "simd.h"
+
+int lanes_available() {
+#if CHIP8_TRACE || CHIP8_PROFILE
+  // Vector steps would bypass the tracing and profiling hooks in cycle().
+  return 0;
+#elif defined(__x86_64__)
+  return __builtin_cpu_supports("avx2");
+#else
+  return 1;
+#endif
+}
+
+// pc and I need 16-bit lanes, which only fill a register with AVX2; split
+// over SSE2 halves this ran slower than the scalar interpreter.
+#if defined(__x86_64__)
+#pragma GCC target("avx2")
+#endif
+
+#define BLEND(mask, new, old) (((new) & (mask)) | ((old) & ~(mask)))
+
+// Plain byte and word views of lane `l`; subscripting the vectors directly
+// makes GCC spill the whole vector for every element.
+#define LANE8(vector, l) (((uint8_t *)&(vector))[l])
+#define LANE16(vector, l) (((uint16_t *)&(vector))[l])
+
+// Turns 16 register vectors into 16 per-lane register files and back.
+static void transpose(lane8_t *const rows) {
+  const lane8_t lo={ 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23 };
+  const lane8_t hi=lo+8;
+  for(int round=0; round<4; ++round) {
+    lane8_t next[16];
+    for(int r=0; r<8; ++r) {
+      next[2*r]=__builtin_shuffle(rows[r], rows[r+8], lo);
+      next[2*r+1]=__builtin_shuffle(rows[r], rows[r+8], hi);
+    }
+    memcpy(rows, next, sizeof(next));
+  }
+}
+
+static void load_lane(struct chip8_lanes_t *const lanes, lane8_t *const v, int l) {
+  const struct chip8_t *const chip8=lanes->lane[l];
+  memcpy(v+l, chip8->v, sizeof(chip8->v));
+  LANE16(lanes->i, l)=chip8->i;
+  LANE16(lanes->pc, l)=chip8->pc;
+  LANE8(lanes->dt, l)=chip8->dt;
+  LANE8(lanes->st, l)=chip8->st;
+}
+
+static void store_lane(struct chip8_lanes_t *const lanes, const lane8_t *const v, int l) {
+  struct chip8_t *const chip8=lanes->lane[l];
+  memcpy(chip8->v, v+l, sizeof(chip8->v));
+  chip8->i=LANE16(lanes->i, l);
+  chip8->pc=LANE16(lanes->pc, l);
+  chip8->dt=LANE8(lanes->dt, l);
+  chip8->st=LANE8(lanes->st, l);
+}
+
+static void mark_dirty(void *context, uint16_t addr, uint16_t size) {
+  struct chip8_lanes_t *const lanes=context;
+  memset(lanes->dirty+addr, 1, size);
+}
+
+void lanes_init(struct chip8_lanes_t *const lanes, struct chip8_t *const chip8[], int count) {
+  memset(lanes, 0, sizeof(*lanes));
+  lanes->count=count;
+  lanes->quirks=count ? chip8[0]->quirks : QUIRKS_modern;
+  for(int l=0; l<count; ++l) {
+    lanes->lane[l]=chip8[l];
+    chip8[l]->on_write=mark_dirty;
+    chip8[l]->on_write_context=lanes;
+    load_lane(lanes, lanes->v, l);
+  }
+  transpose(lanes->v);
+}
+
+void lanes_store(struct chip8_lanes_t *const lanes) {
+  lane8_t v[16];
+  memcpy(v, lanes->v, sizeof(v));
+  transpose(v);
+  for(int l=0; l<lanes->count; ++l) store_lane(lanes, v, l);
+}
+
+void lanes_store_pc(struct chip8_lanes_t *const lanes, int lane) {
+  struct chip8_t *const chip8=lanes->lane[lane];
+  chip8->pc=LANE16(lanes->pc, lane);
+  chip8->dt=LANE8(lanes->dt, lane);
+  chip8->st=LANE8(lanes->st, lane);
+}
+
+void lanes_tick_timers(struct chip8_lanes_t *const lanes, int lane) {
+  if(LANE8(lanes->dt, lane)) LANE8(lanes->dt, lane)--;
+  if(LANE8(lanes->st, lane)) LANE8(lanes->st, lane)--;
+}
+
+static void step_scalar(struct chip8_lanes_t *const lanes, const mask16_t *const active) {
+  lane8_t v[16];
+  memcpy(v, lanes->v, sizeof(v));
+  transpose(v);
+  for(int l=0; l<lanes->count; ++l) {
+    if(!LANE16(*active, l)) continue;
+    store_lane(lanes, v, l);
+    cycle(lanes->lane[l]);
+    load_lane(lanes, v, l);
+  }
+  transpose(v);
+  memcpy(lanes->v, v, sizeof(v));
+  lanes->scalar_steps++;
+}
+
+// Advances the pc of active lanes by one instruction, or two where `skip`.
+static void advance(struct chip8_lanes_t *const lanes, const mask16_t *const active, const mask16_t *const skip) {
+  const lane16_t two=(lane16_t){ 0 }+INSTRUCTION_SIZE;
+  lanes->pc+=(two+(two & (lane16_t)*skip)) & (lane16_t)*active;
+}
+
+static void jump(struct chip8_lanes_t *const lanes, const mask16_t *const active, const lane16_t *const target) {
+  lanes->pc=BLEND((lane16_t)*active, *target, lanes->pc);
+}
+
+// Instructions on memory, the stack, the keypad or the display run the
+// ops.h function on each active lane, copying in only the registers it
+// reads and back only the ones it writes. pc is handled by the caller.
+// Quirk flags are the modern profile's, see step_vector().
+#define FOR_ACTIVE(lanes, active, l) \
+  for(int l=0; l<(lanes)->count; ++l) if(LANE16(*(active), l))
+
+static void lane_memory(struct chip8_lanes_t *const lanes, const mask16_t *const active, uint8_t x, uint8_t kk) {
+  FOR_ACTIVE(lanes, active, l) {
+    struct chip8_t *const chip8=lanes->lane[l];
+    chip8->i=LANE16(lanes->i, l);
+    for(uint8_t r=0; r<=x; ++r) chip8->v[r]=LANE8(lanes->v[r], l);
+    switch(kk) {
+    case 0x33: op_fx33(chip8, x); break;
+    case 0x55: op_fx55(chip8, x, 1); break;
+    case 0x65:
+      op_fx65(chip8, x, 1);
+      for(uint8_t r=0; r<=x; ++r) LANE8(lanes->v[r], l)=chip8->v[r];
+      break;
+    }
+  }
+}
+
+static void lane_draw(struct chip8_lanes_t *const lanes, const mask16_t *const active, uint8_t x, uint8_t y, uint8_t n) {
+  FOR_ACTIVE(lanes, active, l) {
+    struct chip8_t *const chip8=lanes->lane[l];
+    chip8->v[x]=LANE8(lanes->v[x], l);
+    chip8->v[y]=LANE8(lanes->v[y], l);
+    chip8->i=LANE16(lanes->i, l);
+    op_dxyn(chip8, x, y, n, 0);
+    LANE8(lanes->v[0xF], l)=chip8->v[0xF];
+  }
+}
+
+// Returns 0 when the instruction has no lane form and needs cycle().
+static int step_vector(struct chip8_lanes_t *const lanes, const mask16_t *const active, uint16_t pc, uint16_t opcode) {
+  const lane8_t m=(lane8_t)__builtin_convertvector(*active, mask8_t);
+  const uint8_t x=(opcode >> 8) & 0xF, y=(opcode >> 4) & 0xF, kk=opcode & 0xFF;
+  const uint16_t nnn=opcode & 0xFFF;
+  const lane16_t target=(lane16_t){ 0 }+nnn;
+  lane8_t *const v=lanes->v;
+  const lane8_t one=(lane8_t){ 0 }+1;
+  // The lane forms are those of the modern profile; under the others,
+  // whatever the profile changes goes through cycle().
+  if(lanes->quirks != QUIRKS_modern) {
+    const enum kind_t kind=kind_of(opcode);
+    if(kind == KIND_8xy6 || kind == KIND_8xye || kind == KIND_bnnn || kind == KIND_dxyn || kind == KIND_fx55 || kind == KIND_fx65)
+      return 0;
+  }
+  switch(opcode >> 12) {
+  case 0x0:
+    if(nnn == 0x0e0) {
+      FOR_ACTIVE(lanes, active, l) op_00e0(lanes->lane[l]);
+      break;
+    }
+    // SUPER-CHIP display instructions go through cycle().
+    if((nnn & 0xFF0) == 0x0c0 || (nnn >= 0x0fb && nnn <= 0x0ff)) return 0;
+    if(nnn == 0x0ee) {
+      FOR_ACTIVE(lanes, active, l) {
+        struct chip8_t *const chip8=lanes->lane[l];
+        LANE16(lanes->pc, l)=chip8->stack[--chip8->sp & STACK_MASK];
+      }
+      return 1;
+    }
+    jump(lanes, active, &target);
+    return 1;
+  case 0x1:
+    jump(lanes, active, &target);
+    return 1;
+  case 0x2:
+    FOR_ACTIVE(lanes, active, l) {
+      struct chip8_t *const chip8=lanes->lane[l];
+      chip8->stack[chip8->sp++ & STACK_MASK]=pc+INSTRUCTION_SIZE;
+    }
+    jump(lanes, active, &target);
+    return 1;
+  case 0x3:
+  case 0x4: {
+    const mask8_t equal=(mask8_t)(v[x] == kk);
+    const mask16_t skip=__builtin_convertvector((opcode >> 12) == 0x3 ? equal : ~equal, mask16_t);
+    advance(lanes, active, &skip);
+    return 1;
+  }
+  case 0x5:
+  case 0x9:
+    if(opcode & 0xF) return 0;
+    {
+      const mask8_t equal=(mask8_t)(v[x] == v[y]);
+      const mask16_t skip=__builtin_convertvector((opcode >> 12) == 0x5 ? equal : ~equal, mask16_t);
+      advance(lanes, active, &skip);
+    }
+    return 1;
+  case 0x6:
+    v[x]=BLEND(m, (lane8_t){ 0 }+kk, v[x]);
+    break;
+  case 0x7:
+    v[x]+=m & kk;
+    break;
+  case 0x8:
+    // Same statement order as the op_8xy* functions, so x, y and F
+    // aliasing resolves identically.
+    switch(opcode & 0xF) {
+    case 0x0: v[x]=BLEND(m, v[y], v[x]); break;
+    case 0x1: v[x]=BLEND(m, v[x] | v[y], v[x]); break;
+    case 0x2: v[x]=BLEND(m, v[x] & v[y], v[x]); break;
+    case 0x3: v[x]=BLEND(m, v[x] ^ v[y], v[x]); break;
+    case 0x4: {
+      const lane8_t sum=v[x]+v[y];
+      v[0xF]=BLEND(m, (lane8_t)(sum < v[x]) & one, v[0xF]);
+      v[x]=BLEND(m, sum, v[x]);
+      break;
+    }
+    case 0x5:
+      v[0xF]=BLEND(m, (lane8_t)(v[x] > v[y]) & one, v[0xF]);
+      v[x]=BLEND(m, v[x]-v[y], v[x]);
+      break;
+    case 0x6:
+      v[0xF]=BLEND(m, v[x] & one, v[0xF]);
+      v[x]=BLEND(m, v[x] >> 1, v[x]);
+      break;
+    case 0x7:
+      v[0xF]=BLEND(m, (lane8_t)(v[y] > v[x]) & one, v[0xF]);
+      v[x]=BLEND(m, v[y]-v[x], v[x]);
+      break;
+    case 0xe:
+      v[0xF]=BLEND(m, v[x] >> 7, v[0xF]);
+      v[x]=BLEND(m, v[x] << 1, v[x]);
+      break;
+    default:
+      return 0;
+    }
+    break;
+  case 0xa:
+    lanes->i=BLEND((lane16_t)*active, target, lanes->i);
+    break;
+  case 0xb: {
+    const lane16_t offset=__builtin_convertvector(v[0], lane16_t)+nnn;
+    jump(lanes, active, &offset);
+    return 1;
+  }
+  case 0xc:
+    FOR_ACTIVE(lanes, active, l) {
+      struct chip8_t *const chip8=lanes->lane[l];
+      op_cxkk(chip8, x, kk);
+      LANE8(v[x], l)=chip8->v[x];
+    }
+    break;
+  case 0xd:
+    lane_draw(lanes, active, x, y, opcode & 0xF);
+    break;
+  case 0xe:
+    if(kk != 0x9e && kk != 0xa1) return 0;
+    {
+      mask16_t skip={ 0 };
+      FOR_ACTIVE(lanes, active, l) {
+        const uint8_t pressed=(lanes->lane[l]->keys >> (LANE8(v[x], l) & 0xF)) & 1;
+        LANE16(skip, l)=(kk == 0x9e ? pressed : !pressed) ? -1 : 0;
+      }
+      advance(lanes, active, &skip);
+    }
+    return 1;
+  case 0xf:
+    switch(kk) {
+    case 0x07: v[x]=BLEND(m, lanes->dt, v[x]); break;
+    case 0x15: lanes->dt=BLEND(m, v[x], lanes->dt); break;
+    case 0x18: lanes->st=BLEND(m, v[x], lanes->st); break;
+    case 0x1e: lanes->i+=__builtin_convertvector(v[x], lane16_t) & (lane16_t)*active; break;
+    case 0x29: lanes->i=BLEND((lane16_t)*active, __builtin_convertvector(v[x], lane16_t)*5, lanes->i); break;
+    case 0x30: lanes->i=BLEND((lane16_t)*active, (__builtin_convertvector(v[x], lane16_t) & 0xF)*10+BIG_FONT, lanes->i); break;
+    case 0x33:
+    case 0x55:
+    case 0x65: lane_memory(lanes, active, x, kk); break;
+    default: return 0;
+    }
+    break;
+  default:
+    return 0;
+  }
+  advance(lanes, active, &(const mask16_t){ 0 });
+  return 1;
+}
+
+// Lanes share code until one of them stores into it; only then does
+// every active lane need to be checked.
+static int same_opcode(const struct chip8_lanes_t *const lanes, const mask16_t *const active, uint16_t pc, uint16_t opcode) {
+  if(!lanes->dirty[pc] && !lanes->dirty[(pc+1) & RAM_MASK]) return 1;
+  for(int l=0; l<lanes->count; ++l)
+    if(LANE16(*active, l) && fetch(lanes->lane[l], pc) != opcode) return 0;
+  return 1;
+}
+
+// Lowest pc among live lanes, as a log2(LANES) step min reduction. The
+// rotations are spelled out so GCC sees constant shuffles.
+#define MIN_ROTATED(pc, ...) do { \
+    const lane16_t other=__builtin_shuffle(pc, (lane16_t){ __VA_ARGS__ }); \
+    pc=BLEND((lane16_t)(other < pc), other, pc); \
+  } while(0)
+
+static uint16_t lowest_pc(const struct chip8_lanes_t *const lanes, const mask16_t *const live) {
+  lane16_t pc=lanes->pc | ~(lane16_t)*live;
+  MIN_ROTATED(pc, 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+  MIN_ROTATED(pc, 4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8, 9, 10, 11);
+  MIN_ROTATED(pc, 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+  MIN_ROTATED(pc, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  return LANE16(pc, 0);
+}
+
+void lanes_run(struct chip8_lanes_t *const lanes, const uint16_t budget[LANES]) {
+  lane16_t remaining={ 0 };
+  memcpy(&remaining, budget, lanes->count*sizeof(uint16_t));
+  for(;;) {
+    const mask16_t live=(mask16_t)(remaining != (lane16_t){ 0 });
+    uint64_t words[sizeof(live)/sizeof(uint64_t)], any=0;
+    memcpy(words, &live, sizeof(live));
+    for(size_t word=0; word<sizeof(words)/sizeof(words[0]); ++word) any|=words[word];
+    if(!any) break;
+    const uint16_t leader=lowest_pc(lanes, &live);
+    const mask16_t active=live & (mask16_t)(lanes->pc == leader);
+    const uint16_t pc=leader & RAM_MASK;
+    int executed=0;
+    if(leader == pc) {
+      const uint16_t opcode=fetch(lanes->lane[0], pc);
+      if(same_opcode(lanes, &active, pc, opcode)) executed=step_vector(lanes, &active, pc, opcode);
+      if(executed) lanes->vector_steps++;
+    }
+    if(!executed) step_scalar(lanes, &active);
+    remaining-=(lane16_t)active & 1;
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+// Runs up to LANES instances of the same ROM in lockstep. V, I, pc, dt and
+// st are kept as structure-of-arrays vectors; ram, stack, keypad and the
+// display stay in each lane's struct chip8_t.
+//
+// Every step picks the lowest pc among lanes with budget left and executes
+// that instruction for all lanes sitting on it at once, masking the rest.
+// Register, ALU, skip, jump and timer instructions run as vector code;
+// calls, Dxyn, Ex, Cxkk and Fx33/55/65 loop over the active lanes calling
+// the ops.h functions; the rest falls back to cycle() per lane. Lanes
+// share the decoded program until one of them stores into it.
+//
+// Built with GCC vector extensions; on x86-64 the lane code targets AVX2,
+// check lanes_available() before using it.
+
+#define LANES 16
+
+typedef uint8_t lane8_t __attribute__((vector_size(LANES)));
+typedef uint16_t lane16_t __attribute__((vector_size(LANES*2)));
+typedef int8_t mask8_t __attribute__((vector_size(LANES)));
+typedef int16_t mask16_t __attribute__((vector_size(LANES*2)));
+// The lane code loads i and pc with aligned 32-byte moves, but files built
+// without AVX2 give lane16_t only 16-byte alignment. Fixing it here keeps
+// the layout the same everywhere; allocate struct chip8_lanes_t with it.
+#define LANES_ALIGN 32
+
+struct chip8_lanes_t {
+  _Alignas(LANES_ALIGN) lane8_t v[16];
+  _Alignas(LANES_ALIGN) lane16_t i, pc;
+  lane8_t dt, st;
+  struct chip8_t *lane[LANES];
+  int count;
+  enum quirks_t quirks; // shared by all lanes, like the ROM
+  // Addresses any lane stored to; instructions there may differ per lane.
+  uint8_t dirty[1<<12];
+  uint64_t vector_steps, scalar_steps;
+};
+
+int lanes_available();
+// Takes `count` instances booted from the same ROM with the same quirks
+// and loads their registers into the vectors. Installs on_write on each of them.
+void lanes_init(struct chip8_lanes_t *const lanes, struct chip8_t *const chip8[], int count);
+// Runs exactly budget[l] instructions on every lane l.
+void lanes_run(struct chip8_lanes_t *const lanes, const uint16_t budget[LANES]);
+void lanes_tick_timers(struct chip8_lanes_t *const lanes, int lane);
+// Writes the vector registers back into the lane instances.
+void lanes_store(struct chip8_lanes_t *const lanes);
+// Writes back only pc and the timers of one lane, enough to inspect where
+// it is without transposing V.
+void lanes_store_pc(struct chip8_lanes_t *const lanes, int lane);
+
+#endif
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "chip8.h"
+#include "sound.h"
+
+#define WAV_HEADER_SIZE 44
+#define SOUND_PHASE_STEP ((uint32_t)(((uint64_t)SOUND_TONE_HZ<<32)/SOUND_RATE))
+
+void sample_ring_init(struct sample_ring_t *const ring, uint32_t limit) {
+  memset(ring->samples, 0, sizeof(ring->samples));
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->dropped, 0);
+  atomic_init(&ring->underruns, 0);
+  ring->limit=limit > SOUND_RING_SIZE ? SOUND_RING_SIZE : limit;
+}
+
+size_t sample_ring_push(struct sample_ring_t *const ring, const int16_t samples[], size_t count) {
+  const uint32_t head=atomic_load_explicit(&ring->head, memory_order_relaxed);
+  const uint32_t queued=head-atomic_load_explicit(&ring->tail, memory_order_acquire);
+  const size_t room=queued < ring->limit ? ring->limit-queued : 0;
+  const size_t pushed=count < room ? count : room;
+  for(size_t s=0; s<pushed; ++s) ring->samples[(head+s) & (SOUND_RING_SIZE-1)]=samples[s];
+  atomic_store_explicit(&ring->head, head+pushed, memory_order_release);
+  if(pushed < count) atomic_fetch_add_explicit(&ring->dropped, count-pushed, memory_order_relaxed);
+  return pushed;
+}
+
+size_t sample_ring_pop(struct sample_ring_t *const ring, int16_t samples[], size_t count) {
+  const uint32_t tail=atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  const uint32_t queued=atomic_load_explicit(&ring->head, memory_order_acquire)-tail;
+  const size_t popped=count < queued ? count : queued;
+  for(size_t s=0; s<popped; ++s) samples[s]=ring->samples[(tail+s) & (SOUND_RING_SIZE-1)];
+  atomic_store_explicit(&ring->tail, tail+popped, memory_order_release);
+  if(popped < count) atomic_fetch_add_explicit(&ring->underruns, count-popped, memory_order_relaxed);
+  return popped;
+}
+
+void beeper_init(struct beeper_t *const beeper, struct sample_ring_t *const ring) {
+  memset(beeper, 0, sizeof(*beeper));
+  beeper->ring=ring;
+}
+
+static void put_le(uint8_t *const out, uint32_t value, int bytes) {
+  for(int b=0; b<bytes; ++b) out[b]=value >> (8*b);
+}
+
+static void wav_header(uint8_t header[WAV_HEADER_SIZE], uint32_t data_size) {
+  memcpy(header, "RIFF", 4);
+  put_le(header+4, 36+data_size, 4);
+  memcpy(header+8, "WAVEfmt ", 8);
+  put_le(header+16, 16, 4); // fmt chunk size
+  put_le(header+20, 1, 2); // PCM
+  put_le(header+22, 1, 2); // mono
+  put_le(header+24, SOUND_RATE, 4);
+  put_le(header+28, SOUND_RATE*2, 4); // bytes per second
+  put_le(header+32, 2, 2); // bytes per sample
+  put_le(header+34, 16, 2); // bits per sample
+  memcpy(header+36, "data", 4);
+  put_le(header+40, data_size, 4);
+}
+
+int beeper_open_file(struct beeper_t *const beeper, const char *const file_name) {
+  uint8_t header[WAV_HEADER_SIZE];
+  beeper->file=fopen(file_name, "wb");
+  if(!beeper->file) return -1;
+  wav_header(header, 0);
+  if(fwrite(header, sizeof(header), 1, beeper->file) != 1) {
+    fclose(beeper->file);
+    beeper->file=NULL;
+    return -1;
+  }
+  return 0;
+}
+
+int beeper_close_file(struct beeper_t *const beeper) {
+  if(!beeper->file) return 0;
+  uint8_t header[WAV_HEADER_SIZE];
+  wav_header(header, beeper->frames*SOUND_FRAME_SAMPLES*2);
+  int status=0;
+  if(fseek(beeper->file, 0, SEEK_SET) || fwrite(header, sizeof(header), 1, beeper->file) != 1) status=-1;
+  if(fclose(beeper->file)) status=-1;
+  beeper->file=NULL;
+  return status;
+}
+
+void beeper_set(struct beeper_t *const beeper, uint32_t sample, int on) {
+  if(sample > SOUND_FRAME_SAMPLES) sample=SOUND_FRAME_SAMPLES;
+  for(; beeper->position<sample; ++beeper->position) {
+    if(beeper->on) {
+      beeper->frame[beeper->position]=(beeper->phase & 0x80000000) ? -SOUND_AMPLITUDE : SOUND_AMPLITUDE;
+      beeper->phase+=SOUND_PHASE_STEP;
+    }
+    else beeper->frame[beeper->position]=0;
+  }
+  // Every beep starts on the same edge of the wave.
+  if(on && !beeper->on) beeper->phase=0;
+  beeper->on=on != 0;
+}
+
+void beeper_end_frame(struct beeper_t *const beeper) {
+  beeper_set(beeper, SOUND_FRAME_SAMPLES, beeper->on);
+  if(beeper->file) {
+    // Little-endian on disk, whatever the host is.
+    uint8_t bytes[SOUND_FRAME_SAMPLES*2];
+    for(int s=0; s<SOUND_FRAME_SAMPLES; ++s) put_le(bytes+2*s, (uint16_t)beeper->frame[s], 2);
+    fwrite(bytes, sizeof(bytes), 1, beeper->file);
+  }
+  if(beeper->ring) sample_ring_push(beeper->ring, beeper->frame, SOUND_FRAME_SAMPLES);
+  beeper->position=0;
+  beeper->frames++;
+}
+
+void run_sound_frame(struct chip8_t *const chip8, uint32_t instructions, struct beeper_t *const beeper) {
+  struct idle_memo_t memo={ .probe=1 };
+  // Neither idle loops nor fused sequences write st, so skipping or fusing
+  // them loses no edge.
+  for(uint32_t done=0; done<instructions && !waiting_for_key(chip8);) {
+    done+=frame_step(chip8, instructions-done, &memo);
+    if((chip8->st != 0) != beeper->on) beeper_set(beeper, (uint64_t)done*SOUND_FRAME_SAMPLES/instructions, chip8->st != 0);
+  }
+  beeper_end_frame(beeper);
+  tick_timers(chip8);
+  beeper_set(beeper, 0, chip8->st != 0);
+}
@@ -0,0 +1,67 @@
+#ifndef SOUND_H
+#define SOUND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+#include "chip8.h"
+
+// The beeper turns the sound timer into a square wave, one 60 Hz frame of
+// samples at a time. Whoever runs the core tells it at which sample of the
+// frame st became zero or non-zero (instruction k of n lands on sample
+// k*SOUND_FRAME_SAMPLES/n), so a beep starts and stops where its Fx18 was
+// instead of on a frame boundary. Finished frames go to a WAV file, to a
+// ring read by the audio thread, or both.
+
+#define SOUND_RATE 44100
+#define SOUND_FRAME_SAMPLES (SOUND_RATE/TIMER_HZ)
+#define SOUND_TONE_HZ 440
+#define SOUND_AMPLITUDE 0x1000
+// Samples the audio device asks for at a time, about 5.8 ms.
+#define DEFAULT_SOUND_BUFFER 256
+#define SOUND_RING_SIZE 4096 // samples, a power of two
+#define MAX_SOUND_BUFFER ((SOUND_RING_SIZE-SOUND_FRAME_SAMPLES)/2)
+
+// Single producer, single consumer, no locks: the producer only moves
+// `head` and the consumer only moves `tail`.
+struct sample_ring_t {
+  int16_t samples[SOUND_RING_SIZE];
+  _Atomic uint32_t head, tail;
+  // The producer drops what would queue more than this, so drift between
+  // the emulation clock and the audio clock cannot build up latency.
+  uint32_t limit;
+  _Atomic uint64_t dropped, underruns; // samples
+};
+
+struct beeper_t {
+  int16_t frame[SOUND_FRAME_SAMPLES];
+  uint32_t position; // samples of the current frame rendered so far
+  uint32_t phase; // of the square wave, 2^32 per period
+  uint8_t on; // tone state from `position` on
+  uint64_t frames;
+  FILE *file; // optional WAV output
+  struct sample_ring_t *ring; // optional
+};
+
+// `limit` is in samples, at most SOUND_RING_SIZE.
+void sample_ring_init(struct sample_ring_t *const ring, uint32_t limit);
+// Returns how many samples went in; the rest is counted as dropped.
+size_t sample_ring_push(struct sample_ring_t *const ring, const int16_t samples[], size_t count);
+// Returns how many samples came out; the shortfall is counted as underrun.
+size_t sample_ring_pop(struct sample_ring_t *const ring, int16_t samples[], size_t count);
+
+void beeper_init(struct beeper_t *const beeper, struct sample_ring_t *const ring);
+// Starts a 16-bit mono WAV file. Returns -1 if it cannot be written.
+int beeper_open_file(struct beeper_t *const beeper, const char *const file_name);
+// Fills in the WAV sizes and closes the file. Only whole frames are written.
+int beeper_close_file(struct beeper_t *const beeper);
+// Plays the current state up to `sample` of the frame, then switches to `on`.
+void beeper_set(struct beeper_t *const beeper, uint32_t sample, int on);
+// Plays the current state to the end of the frame and hands the frame on.
+void beeper_end_frame(struct beeper_t *const beeper);
+// run_frame() that tells the beeper where st changes, then ends its frame.
+void run_sound_frame(struct chip8_t *const chip8, uint32_t instructions, struct beeper_t *const beeper);
+
+#endif
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "state.h"
+
+static const uint8_t zero_chunk[STATE_CHUNK];
+
+static const uint8_t *base_chunk(const struct chip8_t *const base, int chunk) {
+  return base ? base->ram+chunk*STATE_CHUNK : zero_chunk;
+}
+
+size_t chip8_save_state(const struct chip8_t *const chip8, const struct chip8_t *const base, uint8_t *const buffer, size_t size) {
+  struct state_header_t header={
+    .magic=STATE_MAGIC,
+    .version=STATE_VERSION,
+    .i=chip8->i,
+    .pc=chip8->pc,
+    .sp=chip8->sp,
+    .dt=chip8->dt,
+    .st=chip8->st,
+    .draw=chip8->draw,
+    .keys=chip8->keys,
+    .hires=chip8->hires,
+  };
+  memcpy(header.v, chip8->v, sizeof(header.v));
+  memcpy(header.stack, chip8->stack, sizeof(header.stack));
+  memcpy(header.rng, chip8->rng, sizeof(header.rng));
+
+  size_t at=sizeof(header);
+  for(int chunk=0; chunk<64; ++chunk) {
+    const uint8_t *const bytes=chip8->ram+chunk*STATE_CHUNK;
+    if(!memcmp(bytes, base_chunk(base, chunk), STATE_CHUNK)) continue;
+    if(at+STATE_CHUNK > size) return 0;
+    memcpy(buffer+at, bytes, STATE_CHUNK);
+    at+=STATE_CHUNK;
+    header.ram_chunks|=1ull << chunk;
+  }
+  for(int half=0; half<2; ++half) {
+    for(int y=0; y<HIRES_HEIGHT; ++y) {
+      if(!chip8->frame_buffer[half][y]) continue;
+      if(at+sizeof(uint64_t) > size) return 0;
+      memcpy(buffer+at, chip8->frame_buffer[half]+y, sizeof(uint64_t));
+      at+=sizeof(uint64_t);
+      header.rows[half]|=1ull << y;
+    }
+  }
+  if(sizeof(header) > size) return 0;
+  header.size=at;
+  memcpy(buffer, &header, sizeof(header));
+  return at;
+}
+
+int chip8_load_state(struct chip8_t *const chip8, const struct chip8_t *const base, const uint8_t *const buffer, size_t size) {
+  struct state_header_t header;
+  if(size < sizeof(header)) return -1;
+  memcpy(&header, buffer, sizeof(header));
+  const size_t expected=sizeof(header)
+    +__builtin_popcountll(header.ram_chunks)*STATE_CHUNK
+    +(__builtin_popcountll(header.rows[0])+__builtin_popcountll(header.rows[1]))*sizeof(uint64_t);
+  if(memcmp(header.magic, STATE_MAGIC, 4) || header.version != STATE_VERSION
+     || header.size != expected || size < expected)
+    return -1;
+
+  memcpy(chip8->v, header.v, sizeof(chip8->v));
+  memcpy(chip8->stack, header.stack, sizeof(chip8->stack));
+  memcpy(chip8->rng, header.rng, sizeof(chip8->rng));
+  chip8->i=header.i;
+  chip8->pc=header.pc;
+  chip8->sp=header.sp;
+  chip8->dt=header.dt;
+  chip8->st=header.st;
+  chip8->draw=header.draw;
+  chip8->keys=header.keys;
+  chip8->hires=header.hires != 0;
+  chip8->waiting=0;
+
+  const uint8_t *at=buffer+sizeof(header);
+  for(int chunk=0; chunk<64; ++chunk) {
+    const uint8_t *source=base_chunk(base, chunk);
+    if(header.ram_chunks & (1ull << chunk)) {
+      source=at;
+      at+=STATE_CHUNK;
+    }
+    uint8_t *const bytes=chip8->ram+chunk*STATE_CHUNK;
+    if(!memcmp(bytes, source, STATE_CHUNK)) continue;
+    memcpy(bytes, source, STATE_CHUNK);
+    invalidate_decoded(chip8, chunk*STATE_CHUNK, STATE_CHUNK);
+  }
+  for(int half=0; half<2; ++half) {
+    for(int y=0; y<HIRES_HEIGHT; ++y) {
+      chip8->frame_buffer[half][y]=0;
+      if(!(header.rows[half] & (1ull << y))) continue;
+      memcpy(chip8->frame_buffer[half]+y, at, sizeof(uint64_t));
+      at+=sizeof(uint64_t);
+    }
+  }
+  return 0;
+}
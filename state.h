@@ -0,0 +1,50 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// Snapshots of the machine state, meant to be taken and restored millions
+// of times when forking exploration runs. Layout, host byte order:
+//   struct state_header_t
+//   STATE_CHUNK bytes for every bit set in ram_chunks, lowest first
+//   one uint64_t row for every bit set in rows[0], top first, then the
+//   same for the right half and rows[1]
+// ram chunks equal to the same chunk of `base` are left out, as are blank
+// display rows. `base` is typically the instance right after boot(); NULL
+// compares against zeroes. A snapshot must be loaded with the same base.
+// The decoded cache and on_write hook are not part of the state.
+
+#define STATE_MAGIC "C8ST"
+#define STATE_VERSION 3
+#define STATE_CHUNK 64
+
+struct state_header_t {
+  char magic[4];
+  uint16_t version;
+  uint16_t size; // whole snapshot, header included
+  uint64_t ram_chunks;
+  uint64_t rows[2]; // per half of the display
+  uint16_t i, pc;
+  uint16_t keys; // bit k set while key k is down
+  uint8_t sp, dt, st, draw;
+  uint8_t hires, reserved[5];
+  uint8_t v[16];
+  uint16_t stack[16];
+  uint32_t rng[4];
+};
+_Static_assert(sizeof(struct state_header_t) == 112, "snapshot header is fixed size");
+_Static_assert(RAM_SIZE == 64*STATE_CHUNK, "one ram_chunks bit per chunk");
+
+#define STATE_MAX_SIZE (sizeof(struct state_header_t)+RAM_SIZE+FRAME_BUFFER_SIZE)
+
+// Returns the snapshot size, or 0 when it does not fit in `size` bytes.
+size_t chip8_save_state(const struct chip8_t *const chip8, const struct chip8_t *const base, uint8_t *const buffer, size_t size);
+// Returns -1, leaving chip8 untouched, when buffer is not a snapshot of
+// this version. Only ram chunks that actually change are written, and they
+// go through invalidate_decoded() so caches and on_write hooks follow.
+int chip8_load_state(struct chip8_t *const chip8, const struct chip8_t *const base, const uint8_t *const buffer, size_t size);
+
+#endif
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "threaded.h"
+#include "trace.h"
+#include "profile.h"
+#include "ops.h"
+
+// &&label and goto * are GNU C.
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+// Opcode -> kind for all 64 Ki encodings, filled before main() runs.
+static uint8_t kinds[1<<16];
+
+__attribute__((constructor)) static void init_kinds() {
+  for(uint32_t opcode=0; opcode<(1<<16); ++opcode) kinds[opcode]=kind_of(opcode);
+}
+
+#if !(CHIP8_TRACE || CHIP8_PROFILE)
+// One copy of the dispatch loop per quirk profile, its flags folded in as
+// constants. Labels are local to each copy, so each gets its own table.
+#define KIND_LABEL(name) &&op_##name,
+#define X_ ((opcode >> 8) & 0xF)
+#define Y_ ((opcode >> 4) & 0xF)
+#define DISPATCH() \
+  do { \
+    if(!cycles--) return; \
+    opcode=fetch(chip8, chip8->pc); \
+    goto *labels[kinds[opcode]]; \
+  } while(0)
+#define THREADED_CORE(name, shift_vx, keep_i, jump_vx, wrap) \
+static void run_threaded_##name(struct chip8_t *const chip8, uint64_t cycles) { \
+  static void *const labels[]={ KIND_LIST(KIND_LABEL) }; \
+  uint16_t opcode; \
+  DISPATCH(); \
+op_0nnn: op_0nnn(chip8, opcode & 0xFFF); DISPATCH(); \
+op_00e0: op_00e0(chip8); DISPATCH(); \
+op_00ee: op_00ee(chip8); DISPATCH(); \
+op_00cn: op_00cn(chip8, opcode & 0xF); DISPATCH(); \
+op_00fb: op_00fb(chip8); DISPATCH(); \
+op_00fc: op_00fc(chip8); DISPATCH(); \
+op_00fd: op_00fd(chip8); DISPATCH(); \
+op_00fe: op_00fe(chip8); DISPATCH(); \
+op_00ff: op_00ff(chip8); DISPATCH(); \
+op_1nnn: op_1nnn(chip8, opcode & 0xFFF); DISPATCH(); \
+op_2nnn: op_2nnn(chip8, opcode & 0xFFF); DISPATCH(); \
+op_3xkk: op_3xkk(chip8, X_, opcode & 0xFF); DISPATCH(); \
+op_4xkk: op_4xkk(chip8, X_, opcode & 0xFF); DISPATCH(); \
+op_5xy0: op_5xy0(chip8, X_, Y_); DISPATCH(); \
+op_6xkk: op_6xkk(chip8, X_, opcode & 0xFF); DISPATCH(); \
+op_7xkk: op_7xkk(chip8, X_, opcode & 0xFF); DISPATCH(); \
+op_8xy0: op_8xy0(chip8, X_, Y_); DISPATCH(); \
+op_8xy1: op_8xy1(chip8, X_, Y_); DISPATCH(); \
+op_8xy2: op_8xy2(chip8, X_, Y_); DISPATCH(); \
+op_8xy3: op_8xy3(chip8, X_, Y_); DISPATCH(); \
+op_8xy4: op_8xy4(chip8, X_, Y_); DISPATCH(); \
+op_8xy5: op_8xy5(chip8, X_, Y_); DISPATCH(); \
+op_8xy6: op_8xy6(chip8, X_, Y_, shift_vx); DISPATCH(); \
+op_8xy7: op_8xy7(chip8, X_, Y_); DISPATCH(); \
+op_8xye: op_8xye(chip8, X_, Y_, shift_vx); DISPATCH(); \
+op_9xy0: op_9xy0(chip8, X_, Y_); DISPATCH(); \
+op_annn: op_annn(chip8, opcode & 0xFFF); DISPATCH(); \
+op_bnnn: op_bnnn(chip8, opcode & 0xFFF, jump_vx); DISPATCH(); \
+op_cxkk: op_cxkk(chip8, X_, opcode & 0xFF); DISPATCH(); \
+op_dxyn: op_dxyn(chip8, X_, Y_, opcode & 0xF, wrap); DISPATCH(); \
+op_ex9e: op_ex9e(chip8, X_); DISPATCH(); \
+op_exa1: op_exa1(chip8, X_); DISPATCH(); \
+op_fx07: op_fx07(chip8, X_); DISPATCH(); \
+op_fx0a: op_fx0a(chip8, X_); DISPATCH(); \
+op_fx15: op_fx15(chip8, X_); DISPATCH(); \
+op_fx18: op_fx18(chip8, X_); DISPATCH(); \
+op_fx1e: op_fx1e(chip8, X_); DISPATCH(); \
+op_fx29: op_fx29(chip8, X_); DISPATCH(); \
+op_fx30: op_fx30(chip8, X_); DISPATCH(); \
+op_fx33: op_fx33(chip8, X_); DISPATCH(); \
+op_fx55: op_fx55(chip8, X_, keep_i); DISPATCH(); \
+op_fx65: op_fx65(chip8, X_, keep_i); DISPATCH(); \
+op_unknown: op_unknown(chip8, opcode); DISPATCH(); \
+}
+
+#define X(name, shift_vx, keep_i, jump_vx, wrap) THREADED_CORE(name, shift_vx, keep_i, jump_vx, wrap)
+QUIRK_PROFILES
+#undef X
+#undef THREADED_CORE
+#undef DISPATCH
+#undef Y_
+#undef X_
+#undef KIND_LABEL
+#endif
+
+void run_threaded(struct chip8_t *const chip8, uint64_t cycles) {
+#if CHIP8_TRACE || CHIP8_PROFILE
+  // Tracing and profiling hooks live in cycle(); keep the records complete.
+  while(cycles--) cycle(chip8);
+#else
+#define X(name, shift_vx, keep_i, jump_vx, wrap) run_threaded_##name,
+  static void (*const cores[QUIRKS_COUNT])(struct chip8_t *const, uint64_t)={ QUIRK_PROFILES };
+#undef X
+  cores[chip8->quirks](chip8, cycles);
+#endif
+}
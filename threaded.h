@@ -0,0 +1,15 @@
+#ifndef THREADED_H
+#define THREADED_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+// Alternative core using GCC labels-as-values: every fully decoded opcode
+// (8xy4, Fx33, ...) has its own label ending in its own indirect jump, so
+// the branch predictor sees one dispatch site per opcode instead of the
+// shared call in cycle() plus the switch inside exec_op_8/e/f.
+// Runs exactly `cycles` instructions with the same results as cycle().
+void run_threaded(struct chip8_t *const chip8, uint64_t cycles);
+
+#endif
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#include "trace.h"
+
+struct trace_ring_t trace_ring;
+
+static int write_all(int fd, const void *data, size_t size) {
+  const uint8_t *bytes=data;
+  while(size) {
+    ssize_t written=write(fd, bytes, size);
+    if(written <= 0) return -1;
+    bytes+=written;
+    size-=written;
+  }
+  return 0;
+}
+
+int trace_dump(const char *const file_name) {
+  int fd=open(file_name, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if(fd == -1) return -1;
+  const uint64_t head=trace_ring.head;
+  const uint32_t count=head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+  struct trace_header_t header={ .version=TRACE_VERSION, .record_size=sizeof(struct trace_record_t), .count=count };
+  memcpy(header.magic, TRACE_MAGIC, 4);
+  const uint32_t first=(head-count) & (TRACE_RING_SIZE-1);
+  const uint32_t tail=count < TRACE_RING_SIZE-first ? count : TRACE_RING_SIZE-first;
+  int status=write_all(fd, &header, sizeof(header));
+  if(!status) status=write_all(fd, trace_ring.records+first, tail*sizeof(struct trace_record_t));
+  if(!status) status=write_all(fd, trace_ring.records, (count-tail)*sizeof(struct trace_record_t));
+  close(fd);
+  return status;
+}
+
+static void on_signal(int signal_number) {
+  trace_dump(TRACE_CRASH_FILE);
+  if(signal_number == SIGUSR1) return;
+  signal(signal_number, SIG_DFL);
+  raise(signal_number);
+}
+
+void trace_install_handlers() {
+  int signals[]={ SIGSEGV, SIGBUS, SIGFPE, SIGABRT, SIGUSR1 };
+  for(size_t s=0; s<sizeof(signals)/sizeof(signals[0]); ++s) signal(signals[s], on_signal);
+}
@@ -0,0 +1,65 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Trace levels, picked at build time (make trace=N):
+//   0 - nothing, every trace call is compiled out
+//   1 - one binary trace_record_t per instruction into an in-memory ring
+//   2 - ring plus the old per-instruction disassembly on stdout
+#ifndef CHIP8_TRACE
+#define CHIP8_TRACE 0
+#endif
+
+#if CHIP8_TRACE >= 2
+#define trace_printf(...) printf(__VA_ARGS__)
+#else
+#define trace_printf(...) ((void)0)
+#endif
+
+#define TRACE_MAGIC "C8TR"
+#define TRACE_VERSION 2
+#define TRACE_RING_SIZE (1<<16)
+#define TRACE_CRASH_FILE "chip8-trace.bin"
+
+struct trace_record_t {
+  uint16_t pc, opcode;
+  uint16_t i; // before the instruction, so the address Fx55/Fx65 used
+  uint16_t changed; // bit n set when Vn was written with a new value
+  uint8_t v[16]; // register file after the instruction
+};
+_Static_assert(sizeof(struct trace_record_t) == 24, "trace records are fixed size");
+
+struct trace_header_t {
+  char magic[4];
+  uint16_t version, record_size;
+  uint32_t count;
+};
+
+struct trace_ring_t {
+  uint64_t head;
+  struct trace_record_t records[TRACE_RING_SIZE];
+};
+
+extern struct trace_ring_t trace_ring;
+
+static inline void trace_append(uint16_t pc, uint16_t opcode, uint16_t i, const uint8_t before[16], const uint8_t after[16]) {
+  struct trace_record_t *const record=trace_ring.records+(trace_ring.head++ & (TRACE_RING_SIZE-1));
+  uint16_t changed=0;
+  for(int r=0; r<16; ++r) changed|=(before[r] != after[r]) << r;
+  record->pc=pc;
+  record->opcode=opcode;
+  record->i=i;
+  record->changed=changed;
+  memcpy(record->v, after, 16);
+}
+
+// Writes the ring, oldest record first. Only uses write(2) so it is safe to
+// call from a signal handler.
+int trace_dump(const char *const file_name);
+// Dumps to TRACE_CRASH_FILE on SIGSEGV/SIGBUS/SIGFPE/SIGABRT and on SIGUSR1.
+void trace_install_handlers();
+
+#endif
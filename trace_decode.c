@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "trace.h"
+
+// Offline decoder for trace dumps: turns each binary record back into the
+// "pc opcode => mnemonic" lines the interpreter used to print live.
+
+void disassemble(char *const out, size_t size, const struct trace_record_t *const record) {
+  const uint16_t op=record->opcode;
+  const uint8_t x=(op>>8)&0xF, y=(op>>4)&0xF, n=op&0xF, kk=op&0xFF;
+  const uint16_t nnn=op&0xFFF;
+  switch(op>>12) {
+  case 0x0:
+    if(nnn == 0x0e0) snprintf(out, size, "cls");
+    else if(nnn == 0x0ee) snprintf(out, size, "ret");
+    else if((nnn & 0xFF0) == 0x0c0) snprintf(out, size, "scd %d", n);
+    else if(nnn == 0x0fb) snprintf(out, size, "scr");
+    else if(nnn == 0x0fc) snprintf(out, size, "scl");
+    else if(nnn == 0x0fd) snprintf(out, size, "exit");
+    else if(nnn == 0x0fe) snprintf(out, size, "low");
+    else if(nnn == 0x0ff) snprintf(out, size, "high");
+    else snprintf(out, size, "sys 0x%04X", nnn);
+    break;
+  case 0x1: snprintf(out, size, "jp 0x%04X", nnn); break;
+  case 0x2: snprintf(out, size, "call %d", nnn); break;
+  case 0x3: snprintf(out, size, "se V%d, 0x%04X", x, kk); break;
+  case 0x4: snprintf(out, size, "sne V%d, 0x%04X", x, kk); break;
+  case 0x5: snprintf(out, size, "se V%d, V%d", x, y); break;
+  case 0x6: snprintf(out, size, "ld V%d, 0x%04X", x, kk); break;
+  case 0x7: snprintf(out, size, "add V%d, 0x%04X", x, kk); break;
+  case 0x8: {
+    const char *const names[16]={ "ld", "or", "and", "xor", "add", "sub", "shr", "subn", [0xe]="shl" };
+    if(!names[n]) snprintf(out, size, "??? 0x%04X", op);
+    else if(n == 6) snprintf(out, size, "shr V%d(%d)", x, record->v[x]);
+    else if(n == 0xe) snprintf(out, size, "shl V%d", x);
+    else snprintf(out, size, "%s V%d, V%d", names[n], x, y);
+    break;
+  }
+  case 0x9: snprintf(out, size, "sne V%d, V%d", x, y); break;
+  case 0xa: snprintf(out, size, "ld I, %d", nnn); break;
+  case 0xb: snprintf(out, size, "jp V0, %d", nnn); break;
+  case 0xc: snprintf(out, size, "rnd V%d, 0x%04X", x, record->v[x]); break;
+  case 0xd: snprintf(out, size, "drw V%d, V%d, %x", x, y, n); break;
+  case 0xe:
+    if(kk == 0x9e) snprintf(out, size, "skp V%d", x);
+    else if(kk == 0xa1) snprintf(out, size, "sknp V%d", x);
+    else snprintf(out, size, "??? 0x%04X", op);
+    break;
+  case 0xf:
+    switch(kk) {
+    case 0x07: snprintf(out, size, "ld V%d, DT", x); break;
+    case 0x0a: snprintf(out, size, "ld V%d, %d", x, record->v[x]); break;
+    case 0x15: snprintf(out, size, "ld DT, V%d", x); break;
+    case 0x18: snprintf(out, size, "ld ST, V%d", x); break;
+    case 0x1e: snprintf(out, size, "add I, V%d", x); break;
+    case 0x29: snprintf(out, size, "ld %d, V%d", record->v[x], x); break;
+    case 0x30: snprintf(out, size, "ld HF, V%d", x); break;
+    case 0x33: snprintf(out, size, "ld %d, V%d", record->v[x], x); break;
+    case 0x55: snprintf(out, size, "ld [%d], V%d", record->i, x); break;
+    case 0x65: snprintf(out, size, "ld V%d, [%d]", x, record->i); break;
+    default: snprintf(out, size, "??? 0x%04X", op); break;
+    }
+    break;
+  }
+}
+
+void help() {
+  printf("Help: ./chip8-trace <trace_dump>.bin [-r]\n");
+  printf("  -r  also print the registers each instruction changed\n");
+}
+
+int main(int argc, char **argv) {
+  if(argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "-r"))) {
+    fprintf(stderr, "[ERROR] no trace file was specified\n");
+    help();
+    exit(68);
+  }
+  const int show_registers=(argc == 3);
+  FILE *const file=fopen(argv[1], "rb");
+  if(!file) {
+    fprintf(stderr, "[ERROR] could not open %s\n", argv[1]);
+    exit(80);
+  }
+  struct trace_header_t header;
+  if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, 4)
+     || header.version != TRACE_VERSION || header.record_size != sizeof(struct trace_record_t)) {
+    fprintf(stderr, "[ERROR] %s is not a version %d trace dump\n", argv[1], TRACE_VERSION);
+    exit(81);
+  }
+  struct trace_record_t record;
+  char text[64];
+  for(uint32_t r=0; r<header.count && fread(&record, sizeof(record), 1, file) == 1; ++r) {
+    disassemble(text, sizeof(text), &record);
+    printf("0x%04X 0x%04X => %s", record.pc, record.opcode, text);
+    if(show_registers) {
+      for(int reg=0; reg<16; ++reg)
+        if(record.changed & (1<<reg)) printf("  V%X=0x%02X", reg, record.v[reg]);
+    }
+    printf("\n");
+  }
+  fclose(file);
+  return EXIT_SUCCESS;
+}
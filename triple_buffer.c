@@ -0,0 +1,27 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "triple_buffer.h"
+
+void triple_buffer_init(struct triple_buffer_t *const buffer) {
+  memset(buffer->frames, 0, sizeof(buffer->frames));
+  buffer->back=0;
+  atomic_init(&buffer->middle, 1);
+  buffer->front=2;
+}
+
+int triple_buffer_publish(struct triple_buffer_t *const buffer) {
+  // Release: the rows written into back are visible to whoever takes it.
+  const uint8_t old=atomic_exchange_explicit(&buffer->middle, buffer->back | TRIPLE_BUFFER_FRESH, memory_order_acq_rel);
+  buffer->back=old & ~TRIPLE_BUFFER_FRESH;
+  return (old & TRIPLE_BUFFER_FRESH) != 0;
+}
+
+const struct frame_t *triple_buffer_acquire(struct triple_buffer_t *const buffer) {
+  if(!(atomic_load_explicit(&buffer->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH)) return NULL;
+  // Only the writer sets FRESH, so it is still there for the exchange.
+  const uint8_t old=atomic_exchange_explicit(&buffer->middle, buffer->front, memory_order_acq_rel);
+  buffer->front=old & ~TRIPLE_BUFFER_FRESH;
+  return buffer->frames+buffer->front;
+}
@@ -0,0 +1,42 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "chip8.h"
+
+// Hands finished frames from the emulation thread to the render thread
+// without locks. Of three slots the writer owns one, the reader owns one
+// and the third sits in between; publishing and acquiring each swap their
+// own slot with the middle one in a single atomic exchange, so neither side
+// ever waits for the other or sees a frame being written. A frame the
+// writer replaces before the reader took it is dropped, and counted.
+
+struct frame_t {
+  uint64_t rows[2][HIRES_HEIGHT]; // as in struct chip8_t
+  uint8_t hires;
+  uint64_t number; // frames emulated before this one
+};
+
+#define TRIPLE_BUFFER_FRESH 0x4 // set in `middle` until the reader takes it
+
+struct triple_buffer_t {
+  struct frame_t frames[3];
+  _Atomic uint8_t middle;
+  uint8_t back; // writer's slot
+  uint8_t front; // reader's slot
+};
+
+void triple_buffer_init(struct triple_buffer_t *const buffer);
+// The writer fills this one, then publishes it.
+static inline struct frame_t *triple_buffer_back(struct triple_buffer_t *const buffer) {
+  return buffer->frames+buffer->back;
+}
+// Returns 1 when the frame it replaces was never acquired.
+int triple_buffer_publish(struct triple_buffer_t *const buffer);
+// Returns the newest published frame, or NULL when there is none since the
+// last call. The frame stays valid until the next call.
+const struct frame_t *triple_buffer_acquire(struct triple_buffer_t *const buffer);
+
+#endif